@@ -0,0 +1,161 @@
+#include "audio.h"
+
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#define CACHE_LINE 64
+
+// head and tail count frames since init and are masked on access, so
+// head - tail is always the fill level. Each side owns one index and lives on
+// its own cache line together with the state only it touches.
+typedef struct AudioRing {
+    U32 *frames; // L in the low half, R in the high half
+    size_t mask;
+
+    // producer
+    alignas(CACHE_LINE) _Atomic U64 head;
+    U64 cached_tail;
+    _Atomic U64 pushed_frames;
+    _Atomic U64 dropped_frames;
+
+    // consumer
+    alignas(CACHE_LINE) _Atomic U64 tail;
+    U64 cached_head;
+    _Atomic U64 output_frames;
+    _Atomic U64 underrun_frames;
+    double base_ratio;
+    _Atomic double ratio;
+    size_t target;
+    double position;
+    I16 prev[2];
+    I16 next[2];
+} AudioRing;
+
+static AudioRing ring = { 0 };
+
+void audio_init(double input_rate, double output_rate, size_t capacity, size_t target) {
+    assert(input_rate > 0.0 && output_rate > 0.0);
+
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+
+    free(ring.frames);
+    memset(&ring, 0, sizeof(ring));
+    ring.frames = calloc(size, sizeof(U32));
+    assert(ring.frames != NULL);
+    ring.mask = size - 1;
+    ring.base_ratio = input_rate / output_rate;
+    ring.ratio = ring.base_ratio;
+    ring.target = target > 0 && target < size ? target : size / 2;
+    ring.position = 1.0;
+}
+
+void audio_deinit(void) {
+    free(ring.frames);
+    memset(&ring, 0, sizeof(ring));
+}
+
+size_t audio_push(const I16 *frames, size_t count) {
+    if (ring.frames == NULL) return 0;
+
+    U64 head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+    U64 capacity = ring.mask + 1;
+    if (capacity - (head - ring.cached_tail) < count)
+        ring.cached_tail = atomic_load_explicit(&ring.tail, memory_order_acquire);
+
+    U64 space = capacity - (head - ring.cached_tail);
+    size_t accepted = count < space ? count : (size_t)space;
+    for (size_t i = 0; i < accepted; ++i) {
+        U32 l = (U16)frames[2*i];
+        U32 r = (U16)frames[2*i+1];
+        ring.frames[(head + i) & ring.mask] = l | (r << 16);
+    }
+    atomic_store_explicit(&ring.head, head + accepted, memory_order_release);
+
+    atomic_fetch_add_explicit(&ring.pushed_frames, accepted, memory_order_relaxed);
+    if (accepted < count)
+        atomic_fetch_add_explicit(&ring.dropped_frames, count - accepted, memory_order_relaxed);
+    return accepted;
+}
+
+void audio_pull(I16 *out, size_t count) {
+    if (ring.frames == NULL) {
+        memset(out, 0, count * 2 * sizeof(I16));
+        return;
+    }
+
+    U64 tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+    ring.cached_head = atomic_load_explicit(&ring.head, memory_order_acquire);
+    U64 underruns = 0;
+
+    // Rate control: consume faster when above target, slower when below.
+    double deviation = ((double)(ring.cached_head - tail) - (double)ring.target) / (double)ring.target;
+    if (deviation > 1.0) deviation = 1.0;
+    if (deviation < -1.0) deviation = -1.0;
+    double ratio = ring.base_ratio * (1.0 + AUDIO_MAX_RATE_DELTA * deviation);
+    atomic_store_explicit(&ring.ratio, ratio, memory_order_relaxed);
+
+    for (size_t i = 0; i < count; ++i) {
+        while (ring.position >= 1.0) {
+            ring.position -= 1.0;
+            ring.prev[0] = ring.next[0];
+            ring.prev[1] = ring.next[1];
+            if (tail == ring.cached_head) {
+                ring.cached_head = atomic_load_explicit(&ring.head, memory_order_acquire);
+                if (tail == ring.cached_head) {
+                    // Hold the last sample rather than clicking back to zero.
+                    underruns++;
+                    continue;
+                }
+            }
+            U32 f = ring.frames[tail & ring.mask];
+            ring.next[0] = (I16)(U16)f;
+            ring.next[1] = (I16)(U16)(f >> 16);
+            tail++;
+        }
+
+        double t = ring.position;
+        out[2*i]   = (I16)((double)ring.prev[0] + ((double)ring.next[0] - (double)ring.prev[0]) * t);
+        out[2*i+1] = (I16)((double)ring.prev[1] + ((double)ring.next[1] - (double)ring.prev[1]) * t);
+        ring.position += ratio;
+    }
+
+    atomic_store_explicit(&ring.tail, tail, memory_order_release);
+    atomic_fetch_add_explicit(&ring.output_frames, count, memory_order_relaxed);
+    if (underruns)
+        atomic_fetch_add_explicit(&ring.underrun_frames, underruns, memory_order_relaxed);
+}
+
+size_t audio_fill(void) {
+    U64 head = atomic_load_explicit(&ring.head, memory_order_acquire);
+    U64 tail = atomic_load_explicit(&ring.tail, memory_order_acquire);
+    return (size_t)(head - tail);
+}
+
+bool audio_wait(size_t fill, double timeout) {
+    if (ring.frames == NULL) return true;
+
+    const struct timespec nap = { .tv_sec = 0, .tv_nsec = 500000 };
+    for (double waited = 0.0; audio_fill() > fill; waited += 0.0005) {
+        if (waited >= timeout) return false;
+        nanosleep(&nap, NULL);
+    }
+    return true;
+}
+
+AudioStats audio_stats(void) {
+    return (AudioStats) {
+        .pushed_frames = atomic_load_explicit(&ring.pushed_frames, memory_order_relaxed),
+        .dropped_frames = atomic_load_explicit(&ring.dropped_frames, memory_order_relaxed),
+        .output_frames = atomic_load_explicit(&ring.output_frames, memory_order_relaxed),
+        .underrun_frames = atomic_load_explicit(&ring.underrun_frames, memory_order_relaxed),
+        .capacity = ring.frames != NULL ? ring.mask + 1 : 0,
+        .target = ring.target,
+        .rate_adjust = ring.frames != NULL
+            ? atomic_load_explicit(&ring.ratio, memory_order_relaxed) / ring.base_ratio : 1.0,
+    };
+}
@@ -0,0 +1,49 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include "types.h"
+
+// Single-producer/single-consumer ring of interleaved stereo I16 frames. The
+// emulation thread pushes from the libretro audio callbacks, the audio
+// device thread pulls output-rate frames through a linear resampler.
+//
+// The resampler does dynamic rate control: the ratio is nudged by at most
+// AUDIO_MAX_RATE_DELTA depending on how far the fill level is from the
+// target, so small differences between the core's frame rate and the
+// display's refresh rate never drain or overflow the ring.
+
+#define AUDIO_MAX_RATE_DELTA 0.005
+
+typedef struct AudioStats {
+    U64 pushed_frames;   // input frames accepted into the ring
+    U64 dropped_frames;  // input frames lost because the ring was full
+    U64 output_frames;   // frames handed to the device
+    U64 underrun_frames; // output frames generated with the ring empty
+    size_t capacity;     // ring size in input frames
+    size_t target;       // fill level rate control aims for
+    double rate_adjust;  // current ratio relative to the nominal one
+} AudioStats;
+
+// capacity is rounded up to a power of two. target is the fill level, in
+// input frames, that rate control steers towards.
+void audio_init(double input_rate, double output_rate, size_t capacity, size_t target);
+void audio_deinit(void);
+
+// Producer side. Returns the number of frames accepted.
+size_t audio_push(const I16 *frames, size_t count);
+
+// Consumer side. Always writes count frames, padding with the last sample
+// when the ring runs dry.
+void audio_pull(I16 *out, size_t count);
+
+// Input frames currently queued.
+size_t audio_fill(void);
+
+// Producer side. Sleeps until at most fill frames are queued or timeout
+// seconds have passed, so emulation can't run ahead of the audio device.
+// Returns false on timeout.
+bool audio_wait(size_t fill, double timeout);
+
+AudioStats audio_stats(void);
+
+#endif
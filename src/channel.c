@@ -0,0 +1,192 @@
+// for memfd_create
+#define _GNU_SOURCE
+#include "channel.h"
+#include "clock.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define CHANNEL_ALIGN 4096
+
+static size_t align_up(size_t n, size_t align) {
+    return (n + align - 1) & ~(align - 1);
+}
+
+static ChannelSlot *slot_at(const Channel *ch, U32 i) {
+    return (ChannelSlot *)(ch->base + ch->header->header_size + ch->header->slot_size * (i & 3u));
+}
+
+static U8 *pixels(ChannelSlot *slot) {
+    return (U8 *)slot + CHANNEL_SLOT_HEADER;
+}
+
+static void futex_wake(_Atomic U32 *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void futex_wait(_Atomic U32 *word, U32 expected, double timeout) {
+    struct timespec ts = {
+        .tv_sec = (time_t)timeout,
+        .tv_nsec = (long)((timeout - (double)(time_t)timeout) * 1e9),
+    };
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, &ts, NULL, 0);
+}
+
+static bool map_channel(Channel *ch, int fd, size_t size, int prot) {
+    void *base = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) return false;
+    ch->fd = fd;
+    ch->base = base;
+    ch->size = size;
+    ch->header = base;
+    return true;
+}
+
+// WRITER #######################################################################
+
+bool channel_create(Channel *ch, unsigned max_width, unsigned max_height,
+    const ChannelRegion *regions, unsigned region_count
+) {
+    memset(ch, 0, sizeof(*ch));
+    ch->fd = -1;
+    if (region_count > CHANNEL_MAX_REGIONS) return false;
+
+    ChannelHeader header = {
+        .magic = CHANNEL_MAGIC,
+        .version = CHANNEL_VERSION,
+        .max_width = max_width,
+        .max_height = max_height,
+        .header_size = align_up(sizeof(ChannelHeader), CHANNEL_ALIGN),
+        .region_count = region_count,
+    };
+    size_t slot_size = CHANNEL_SLOT_HEADER + (size_t)max_width * max_height * 4;
+    for (unsigned i = 0; i < region_count; ++i) {
+        slot_size = align_up(slot_size, CHANNEL_SLOT_HEADER);
+        header.regions[i] = regions[i];
+        header.regions[i].offset = (U32)slot_size;
+        slot_size += regions[i].size;
+    }
+    header.slot_size = align_up(slot_size, CHANNEL_ALIGN);
+    size_t size = header.header_size + header.slot_size * CHANNEL_SLOTS;
+
+    // Not MFD_CLOEXEC: the consumer may be a child that inherits the fd.
+    int fd = memfd_create("dolphin_embed_channel", 0);
+    if (fd < 0) return false;
+    if (ftruncate(fd, (off_t)size) != 0 || !map_channel(ch, fd, size, PROT_READ | PROT_WRITE)) {
+        close(fd);
+        ch->fd = -1;
+        return false;
+    }
+
+    // The fresh pages are zero, so every slot starts as an empty frame 0.
+    memcpy(ch->header, &header, offsetof(ChannelHeader, middle));
+    atomic_store_explicit(&ch->header->middle, 1, memory_order_release);
+    ch->back = 0;
+    ch->last = 2;
+    return true;
+}
+
+void channel_write_frame(Channel *ch, const void *data, unsigned width, unsigned height,
+    size_t pitch, ConvertFn convert, bool dup
+) {
+    if (dup) return;
+    ChannelHeader *h = ch->header;
+    if (width > h->max_width) width = h->max_width;
+    if (height > h->max_height) height = h->max_height;
+
+    ChannelSlot *slot = slot_at(ch, ch->back);
+    convert(pixels(slot), (size_t)h->max_width * 4, data, pitch, width, height);
+    slot->width = width;
+    slot->height = height;
+    ch->frame_written = true;
+}
+
+void channel_publish(Channel *ch, U64 frame, const MemoryMap *memory) {
+    ChannelHeader *h = ch->header;
+    ChannelSlot *slot = slot_at(ch, ch->back);
+
+    if (!ch->frame_written) {
+        // The last published slot is middle or the reader's front now, and
+        // neither side writes to it, so it can be read from here.
+        const ChannelSlot *last = slot_at(ch, ch->last);
+        memcpy(pixels(slot), (const U8 *)last + CHANNEL_SLOT_HEADER, (size_t)h->max_width * last->height * 4);
+        slot->width = last->width;
+        slot->height = last->height;
+    }
+
+    for (U32 i = 0; i < h->region_count; ++i) {
+        const ChannelRegion *r = &h->regions[i];
+        memmap_read(memory, r->address, (U8 *)slot + r->offset, r->size);
+    }
+    slot->frame = frame;
+
+    ch->last = ch->back;
+    ch->frame_written = false;
+    U32 prev = atomic_exchange(&h->middle, ch->back | CHANNEL_FRESH);
+    ch->back = prev & 3u;
+
+    atomic_fetch_add(&h->sequence, 1);
+    if (atomic_load(&h->waiters) != 0) futex_wake(&h->sequence);
+}
+
+// READER #######################################################################
+
+bool channel_open(Channel *ch, const char *path) {
+    memset(ch, 0, sizeof(*ch));
+    ch->fd = -1;
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ChannelHeader)
+        || !map_channel(ch, fd, (size_t)st.st_size, PROT_READ | PROT_WRITE)
+    ) {
+        close(fd);
+        return false;
+    }
+
+    const ChannelHeader *h = ch->header;
+    if (memcmp(h->magic, CHANNEL_MAGIC, 4) != 0 || h->version != CHANNEL_VERSION
+        || h->header_size + h->slot_size * CHANNEL_SLOTS > ch->size
+    ) {
+        channel_close(ch);
+        return false;
+    }
+    ch->front = 2;
+    return true;
+}
+
+const ChannelSlot *channel_acquire(Channel *ch, double timeout) {
+    ChannelHeader *h = ch->header;
+    double deadline = time_now() + timeout;
+    for (;;) {
+        if (atomic_load(&h->middle) & CHANNEL_FRESH) {
+            U32 prev = atomic_exchange(&h->middle, ch->front);
+            ch->front = prev & 3u;
+            return slot_at(ch, ch->front);
+        }
+
+        double remaining = deadline - time_now();
+        if (remaining <= 0.0) return NULL;
+
+        U32 sequence = atomic_load(&h->sequence);
+        atomic_fetch_add(&h->waiters, 1);
+        if (!(atomic_load(&h->middle) & CHANNEL_FRESH))
+            futex_wait(&h->sequence, sequence, remaining);
+        atomic_fetch_sub(&h->waiters, 1);
+    }
+}
+
+void channel_close(Channel *ch) {
+    if (ch->base != NULL) munmap(ch->base, ch->size);
+    if (ch->fd >= 0) close(ch->fd);
+    memset(ch, 0, sizeof(*ch));
+    ch->fd = -1;
+}
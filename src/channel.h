@@ -0,0 +1,108 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include "convert.h"
+#include "memmap.h"
+#include "types.h"
+
+#include <stdatomic.h>
+#include <stdalign.h>
+
+// Observation channel to one consumer in another process. The channel is a
+// memfd the consumer maps through /proc/<pid>/fd/<fd>, laid out as a
+// ChannelHeader followed by three slots. Each slot holds a ChannelSlot, the
+// frame as RGBA8 at a pitch of max_width * 4, then each RAM region at its
+// offset. Nothing is copied through the kernel and neither side locks.
+//
+// The slots are a triple buffer like the one in input.c. The writer fills its
+// back slot and swaps it into middle with CHANNEL_FRESH set. The reader swaps
+// a fresh middle with its front slot and reads that until the next swap.
+// sequence counts publishes; a reader with nothing fresh sleeps on it as a
+// futex, and the writer only makes the wake syscall while waiters is nonzero.
+
+#define CHANNEL_MAGIC "DEOB"
+#define CHANNEL_VERSION 1
+#define CHANNEL_MAX_REGIONS 16
+#define CHANNEL_SLOTS 3
+#define CHANNEL_FRESH 4u
+#define CHANNEL_SLOT_HEADER 64
+
+typedef struct ChannelRegion {
+    U32 address;  // GameCube address
+    U32 size;
+    U32 offset;   // from the start of a slot, set by channel_create
+    U32 reserved;
+} ChannelRegion;
+
+typedef struct ChannelHeader {
+    char magic[4];
+    U32 version;
+    U32 max_width;
+    U32 max_height;
+    U64 header_size;
+    U64 slot_size;
+    U32 region_count;
+    U32 reserved;
+    ChannelRegion regions[CHANNEL_MAX_REGIONS];
+
+    alignas(64) _Atomic U32 middle;
+    alignas(64) _Atomic U32 sequence;
+    _Atomic U32 waiters;
+} ChannelHeader;
+
+typedef struct ChannelSlot {
+    U64 frame;    // frame number, counted from 1
+    U32 width;    // size of this frame, at most max_width x max_height
+    U32 height;
+} ChannelSlot;
+
+typedef struct Channel {
+    int fd;
+    U8 *base;
+    size_t size;
+    ChannelHeader *header;
+
+    // writer
+    U32 back;
+    U32 last;
+    bool frame_written;
+
+    // reader
+    U32 front;
+} Channel;
+
+// WRITER #######################################################################
+
+// Regions are read through the core's memory map.
+bool channel_create(Channel *ch, unsigned max_width, unsigned max_height,
+    const ChannelRegion *regions, unsigned region_count);
+
+// Converts a frame into the back slot. Frames larger than the maximum are
+// clipped. A frame marked dup, identical to the last one written, is not
+// converted again; publishing carries the last one over instead.
+void channel_write_frame(Channel *ch, const void *data, unsigned width, unsigned height,
+    size_t pitch, ConvertFn convert, bool dup);
+
+// Copies the RAM regions into the back slot and publishes it. If no frame was
+// written since the last publish, the previous frame is carried over.
+void channel_publish(Channel *ch, U64 frame, const MemoryMap *memory);
+
+// READER #######################################################################
+
+bool channel_open(Channel *ch, const char *path);
+
+// Takes the newest published slot, waiting up to timeout seconds for one
+// newer than the last. Returns NULL on timeout.
+const ChannelSlot *channel_acquire(Channel *ch, double timeout);
+
+static inline const U8 *channel_pixels(const ChannelSlot *slot) {
+    return (const U8 *)slot + CHANNEL_SLOT_HEADER;
+}
+
+static inline const U8 *channel_region(const Channel *ch, const ChannelSlot *slot, unsigned i) {
+    return (const U8 *)slot + ch->header->regions[i].offset;
+}
+
+void channel_close(Channel *ch);
+
+#endif
@@ -0,0 +1,323 @@
+#include "chunkstore.h"
+#include "hash.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define CHUNK_SEED_LO 0
+#define CHUNK_SEED_HI UINT64_C(0x9E3779B97F4A7C15)
+
+// Below this many chunks a state is read on the calling thread.
+#define CHUNKSTORE_PARALLEL_MIN 64
+
+typedef struct StateRecord {
+    U64 size;
+    U32 chunk_count;
+} __attribute__((packed)) StateRecord;
+
+static bool pread_all(int fd, U8 *dst, size_t size, U64 offset) {
+    while (size != 0) {
+        ssize_t n = pread(fd, dst, size, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        dst += n;
+        size -= (size_t)n;
+        offset += (U64)n;
+    }
+    return true;
+}
+
+static bool pwrite_all(int fd, const U8 *src, size_t size, U64 offset) {
+    while (size != 0) {
+        ssize_t n = pwrite(fd, src, size, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        src += n;
+        size -= (size_t)n;
+        offset += (U64)n;
+    }
+    return true;
+}
+
+static size_t chunks_for(size_t size) {
+    return (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+
+// INDEX ########################################################################
+
+static bool hash_equal(ChunkHash a, ChunkHash b) {
+    return a.lo == b.lo && a.hi == b.hi;
+}
+
+// Chunks whose hashes collide each get their own entry in the probe run of
+// that hash. Returns the first slot from slot on holding hash, or the empty
+// slot that ends the run.
+static size_t find_slot(const ChunkStore *s, ChunkHash hash, size_t slot) {
+    while (s->table[slot] != 0 && !hash_equal(s->hashes[s->table[slot] - 1], hash))
+        slot = (slot + 1) & s->table_mask;
+    return slot;
+}
+
+static void index_chunk(ChunkStore *s, U32 id) {
+    size_t slot = s->hashes[id].lo & s->table_mask;
+    while (s->table[slot] != 0) slot = (slot + 1) & s->table_mask;
+    s->table[slot] = id + 1;
+}
+
+// Sizes the table for at least twice chunks entries and indexes hashes[0..count).
+static bool rebuild_table(ChunkStore *s, size_t chunks) {
+    size_t capacity = 1024;
+    while (capacity < chunks * 2) capacity *= 2;
+    U32 *table = calloc(capacity, sizeof(U32));
+    if (table == NULL) return false;
+    free(s->table);
+    s->table = table;
+    s->table_mask = capacity - 1;
+    for (U32 i = 0; i < s->chunk_count; ++i) index_chunk(s, i);
+    return true;
+}
+
+static bool reserve_chunks(ChunkStore *s, size_t chunks) {
+    if (chunks > UINT32_MAX - 1) return false;
+    if (chunks > s->hash_capacity) {
+        size_t capacity = s->hash_capacity ? s->hash_capacity : 1024;
+        while (capacity < chunks) capacity *= 2;
+        if (capacity > UINT32_MAX) capacity = UINT32_MAX;
+        ChunkHash *hashes = realloc(s->hashes, capacity * sizeof(ChunkHash));
+        if (hashes == NULL) return false;
+        s->hashes = hashes;
+        s->hash_capacity = (U32)capacity;
+    }
+    if (chunks * 2 > s->table_mask + 1) return rebuild_table(s, chunks);
+    return true;
+}
+
+static bool reserve_scratch(ChunkStore *s, size_t chunks) {
+    if (chunks <= s->scratch_chunks) return true;
+    U8 *pending = realloc(s->pending, chunks * CHUNK_SIZE);
+    if (pending != NULL) s->pending = pending;
+    U32 *ids = realloc(s->ids, chunks * sizeof(U32));
+    if (ids != NULL) s->ids = ids;
+    if (pending == NULL || ids == NULL) return false;
+    s->scratch_chunks = chunks;
+    return true;
+}
+
+// OPEN #########################################################################
+
+static int open_in(const char *dir, const char *name) {
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path)) return -1;
+    return open(path, O_RDWR | O_CREAT, 0644);
+}
+
+// Reads the hashes of chunks past chunk_count. Also how a store is opened.
+static bool load_index(ChunkStore *s) {
+    struct stat pack, index, states;
+    if (fstat(s->pack_fd, &pack) != 0 || fstat(s->index_fd, &index) != 0 || fstat(s->states_fd, &states) != 0)
+        return false;
+
+    // Chunks missing from either file were never referenced by a state.
+    U64 chunks = (U64)index.st_size / sizeof(ChunkHash);
+    U64 packed = (U64)pack.st_size / CHUNK_SIZE;
+    if (packed < chunks) chunks = packed;
+    if (chunks < s->chunk_count) return false;
+    if (!reserve_chunks(s, chunks)) return false;
+    U32 first = s->chunk_count;
+    if (!pread_all(s->index_fd, (U8 *)(s->hashes + first), (chunks - first) * sizeof(ChunkHash),
+        first * sizeof(ChunkHash)))
+        return false;
+    for (U32 i = first; i < chunks; ++i) {
+        index_chunk(s, i);
+        s->chunk_count = i + 1;
+    }
+    s->states_end = (U64)states.st_size;
+    return true;
+}
+
+bool chunkstore_open(ChunkStore *s, const char *dir) {
+    memset(s, 0, sizeof(*s));
+    s->pack_fd = s->index_fd = s->states_fd = -1;
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) return false;
+
+    s->pack_fd = open_in(dir, "chunks.pack");
+    s->index_fd = open_in(dir, "chunks.idx");
+    s->states_fd = open_in(dir, "states");
+    if (s->pack_fd < 0 || s->index_fd < 0 || s->states_fd < 0 || !load_index(s)) {
+        chunkstore_close(s);
+        return false;
+    }
+    return true;
+}
+
+bool chunkstore_refresh(ChunkStore *s) {
+    return load_index(s);
+}
+
+void chunkstore_close(ChunkStore *s) {
+    if (s->pack_fd >= 0) close(s->pack_fd);
+    if (s->index_fd >= 0) close(s->index_fd);
+    if (s->states_fd >= 0) close(s->states_fd);
+    free(s->hashes);
+    free(s->table);
+    free(s->pending);
+    free(s->ids);
+    memset(s, 0, sizeof(*s));
+    s->pack_fd = s->index_fd = s->states_fd = -1;
+}
+
+// PUT ##########################################################################
+
+// A hash hit is only shared once the stored bytes match, so a collision
+// costs a second chunk under the same hash instead of a corrupt state. A hit
+// on a chunk from an earlier put reads it back, usually from the page cache.
+static bool chunk_matches(ChunkStore *s, U32 id, const U8 *chunk, U32 first_new) {
+    if (id >= first_new)
+        return memcmp(s->pending + (size_t)(id - first_new) * CHUNK_SIZE, chunk, CHUNK_SIZE) == 0;
+    U8 stored[CHUNK_SIZE];
+    return pread_all(s->pack_fd, stored, CHUNK_SIZE, (U64)id * CHUNK_SIZE)
+        && memcmp(stored, chunk, CHUNK_SIZE) == 0;
+}
+
+bool chunkstore_put(ChunkStore *s, const U8 *state, size_t size, U64 *id) {
+    size_t count = chunks_for(size);
+    if (count == 0 || count > UINT32_MAX || !reserve_scratch(s, count)) return false;
+    if (!reserve_chunks(s, (size_t)s->chunk_count + count)) return false;
+
+    U32 first_new = s->chunk_count;
+    for (size_t i = 0; i < count; ++i) {
+        const U8 *chunk = state + i * CHUNK_SIZE;
+        U8 *padded = s->pending + (size_t)(s->chunk_count - first_new) * CHUNK_SIZE;
+        // The tail is hashed and stored zero padded to a whole chunk.
+        if ((i + 1) * CHUNK_SIZE > size) {
+            size_t tail = size - i * CHUNK_SIZE;
+            memcpy(padded, chunk, tail);
+            memset(padded + tail, 0, CHUNK_SIZE - tail);
+            chunk = padded;
+        }
+
+        ChunkHash hash = {
+            hash_bytes(chunk, CHUNK_SIZE, CHUNK_SEED_LO),
+            hash_bytes(chunk, CHUNK_SIZE, CHUNK_SEED_HI),
+        };
+        size_t slot = find_slot(s, hash, hash.lo & s->table_mask);
+        while (s->table[slot] != 0 && !chunk_matches(s, s->table[slot] - 1, chunk, first_new))
+            slot = find_slot(s, hash, (slot + 1) & s->table_mask);
+        if (s->table[slot] != 0) {
+            s->ids[i] = s->table[slot] - 1;
+            continue;
+        }
+        // New, or colliding with every chunk of its hash: the empty slot
+        // ending the run is where it goes.
+        if (chunk != padded) memcpy(padded, chunk, CHUNK_SIZE);
+        s->hashes[s->chunk_count] = hash;
+        s->ids[i] = s->chunk_count++;
+        s->table[slot] = s->chunk_count;
+    }
+
+    // Chunks, then their hashes, then the state referring to them.
+    U32 added = s->chunk_count - first_new;
+    StateRecord record = { .size = size, .chunk_count = (U32)count };
+    bool ok = pwrite_all(s->pack_fd, s->pending, (size_t)added * CHUNK_SIZE, (U64)first_new * CHUNK_SIZE)
+        && pwrite_all(s->index_fd, (const U8 *)(s->hashes + first_new), added * sizeof(ChunkHash),
+            (U64)first_new * sizeof(ChunkHash))
+        && pwrite_all(s->states_fd, (const U8 *)&record, sizeof(record), s->states_end)
+        && pwrite_all(s->states_fd, (const U8 *)s->ids, count * sizeof(U32), s->states_end + sizeof(record));
+    if (!ok) {
+        // Forget the chunks that didn't make it; later puts overwrite them.
+        s->chunk_count = first_new;
+        rebuild_table(s, s->chunk_count);
+        return false;
+    }
+
+    *id = s->states_end;
+    s->states_end += sizeof(record) + count * sizeof(U32);
+    s->puts++;
+    s->put_bytes += size;
+    s->new_chunks += added;
+    return true;
+}
+
+// GET ##########################################################################
+
+typedef struct ReadJob {
+    int fd;
+    const U32 *ids;
+    U8 *dst;
+    size_t size;   // of the whole state
+    size_t first;  // chunk range [first, last)
+    size_t last;
+    bool ok;
+} ReadJob;
+
+static void *read_chunks(void *arg) {
+    ReadJob *job = arg;
+    job->ok = true;
+    for (size_t i = job->first; job->ok && i < job->last;) {
+        size_t run = 1;
+        while (i + run < job->last && job->ids[i + run] == job->ids[i] + run) run++;
+
+        size_t offset = i * CHUNK_SIZE;
+        size_t end = (i + run) * CHUNK_SIZE;
+        if (end > job->size) end = job->size;
+        job->ok = pread_all(job->fd, job->dst + offset, end - offset, (U64)job->ids[i] * CHUNK_SIZE);
+        i += run;
+    }
+    return NULL;
+}
+
+static bool read_record(ChunkStore *s, U64 id, StateRecord *record) {
+    return id + sizeof(*record) <= s->states_end
+        && pread_all(s->states_fd, (U8 *)record, sizeof(*record), id)
+        && record->chunk_count == chunks_for(record->size)
+        && id + sizeof(*record) + record->chunk_count * sizeof(U32) <= s->states_end;
+}
+
+bool chunkstore_size(ChunkStore *s, U64 id, size_t *size) {
+    StateRecord record;
+    if (!read_record(s, id, &record)) return false;
+    *size = record.size;
+    return true;
+}
+
+bool chunkstore_get(ChunkStore *s, U64 id, U8 *dst, size_t size) {
+    StateRecord record;
+    if (!read_record(s, id, &record) || record.size != size) return false;
+    size_t count = record.chunk_count;
+    if (!reserve_scratch(s, count)) return false;
+    if (!pread_all(s->states_fd, (U8 *)s->ids, count * sizeof(U32), id + sizeof(record))) return false;
+    for (size_t i = 0; i < count; ++i)
+        if (s->ids[i] >= s->chunk_count) return false;
+
+    ReadJob jobs[CHUNKSTORE_READERS];
+    unsigned readers = count < CHUNKSTORE_PARALLEL_MIN ? 1 : CHUNKSTORE_READERS;
+    for (unsigned r = 0; r < readers; ++r) {
+        jobs[r] = (ReadJob) {
+            .fd = s->pack_fd, .ids = s->ids, .dst = dst, .size = size,
+            .first = count * r / readers,
+            .last = count * (r + 1) / readers,
+        };
+    }
+
+    // The calling thread takes the first range itself.
+    pthread_t threads[CHUNKSTORE_READERS];
+    bool started[CHUNKSTORE_READERS] = { 0 };
+    for (unsigned r = 1; r < readers; ++r)
+        started[r] = pthread_create(&threads[r], NULL, read_chunks, &jobs[r]) == 0;
+    read_chunks(&jobs[0]);
+
+    bool ok = jobs[0].ok;
+    for (unsigned r = 1; r < readers; ++r) {
+        if (started[r]) pthread_join(threads[r], NULL);
+        else read_chunks(&jobs[r]);
+        ok = ok && jobs[r].ok;
+    }
+    return ok;
+}
@@ -0,0 +1,71 @@
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include "types.h"
+
+// Content-addressed savestate storage. A state is cut into CHUNK_SIZE chunks
+// named by a 128-bit hash (hash_bytes under two seeds), and each distinct
+// chunk is stored once however many states contain it. A chunk is only shared
+// after its bytes are compared with a stored chunk of the same hash; chunks
+// whose hashes collide are all stored and indexed. States of the same stage
+// and characters share most of their pages, so a large set of start positions
+// costs little more on disk, or in the page cache, than a few.
+//
+// A store is a directory of three append-only files:
+//   chunks.pack  chunk i at offset i * CHUNK_SIZE, the last chunk of a state
+//                zero padded
+//   chunks.idx   the 16 byte hash of chunk i
+//   states       per state: U64 size, U32 chunk count, U32 chunk ids[]
+// A state's id is the offset of its record in states. Each file is written
+// before anything that refers to it, so a store cut short by a crash opens
+// with at most some unreferenced chunks.
+//
+// Loading reads a state's chunks with pread from CHUNKSTORE_READERS threads,
+// merging runs of consecutive chunks into one read.
+
+#define CHUNK_SIZE 4096
+#define CHUNKSTORE_READERS 4
+
+typedef struct ChunkHash {
+    U64 lo;
+    U64 hi;
+} ChunkHash;
+
+typedef struct ChunkStore {
+    int pack_fd;
+    int index_fd;
+    int states_fd;
+    U64 states_end;
+
+    ChunkHash *hashes;   // by chunk id
+    U32 chunk_count;
+    U32 hash_capacity;
+    U32 *table;          // open addressing, chunk id + 1, 0 when empty
+    size_t table_mask;
+
+    U8 *pending;         // chunks new to this put, written in one go
+    U32 *ids;            // chunk ids of the state being put or got
+    size_t scratch_chunks;
+
+    // Since open. The pack holds chunk_count * CHUNK_SIZE bytes in all.
+    U64 puts;
+    U64 put_bytes;
+    U64 new_chunks;
+} ChunkStore;
+
+// Opens or creates the store in dir.
+bool chunkstore_open(ChunkStore *s, const char *dir);
+void chunkstore_close(ChunkStore *s);
+
+bool chunkstore_put(ChunkStore *s, const U8 *state, size_t size, U64 *id);
+
+// Picks up chunks and states appended by another process since open.
+bool chunkstore_refresh(ChunkStore *s);
+
+// Size in bytes of a stored state.
+bool chunkstore_size(ChunkStore *s, U64 id, size_t *size);
+
+// Reconstructs a state into dst, which must hold its size.
+bool chunkstore_get(ChunkStore *s, U64 id, U8 *dst, size_t size);
+
+#endif
@@ -0,0 +1,240 @@
+#include "convert.h"
+#include "simd.h"
+
+// SCALAR #######################################################################
+
+static inline U32 xrgb8888_to_rgba(U32 p) {
+    return 0xFF000000u | (p & 0x0000FF00u) | ((p >> 16) & 0xFFu) | ((p & 0xFFu) << 16);
+}
+
+static inline U32 rgb565_to_rgba(U16 p) {
+    U32 r = (p >> 11) & 0x1Fu;
+    U32 g = (p >> 5) & 0x3Fu;
+    U32 b = p & 0x1Fu;
+    r = (r << 3) | (r >> 2);
+    g = (g << 2) | (g >> 4);
+    b = (b << 3) | (b >> 2);
+    return 0xFF000000u | (b << 16) | (g << 8) | r;
+}
+
+static inline U32 rgb1555_to_rgba(U16 p) {
+    U32 r = (p >> 10) & 0x1Fu;
+    U32 g = (p >> 5) & 0x1Fu;
+    U32 b = p & 0x1Fu;
+    r = (r << 3) | (r >> 2);
+    g = (g << 3) | (g >> 2);
+    b = (b << 3) | (b >> 2);
+    return 0xFF000000u | (b << 16) | (g << 8) | r;
+}
+
+static void xrgb8888_row_scalar(U32 *dst, const U32 *src, unsigned width) {
+    for (unsigned x = 0; x < width; ++x) dst[x] = xrgb8888_to_rgba(src[x]);
+}
+
+static void rgb565_row_scalar(U32 *dst, const U16 *src, unsigned width) {
+    for (unsigned x = 0; x < width; ++x) dst[x] = rgb565_to_rgba(src[x]);
+}
+
+static void rgb1555_row_scalar(U32 *dst, const U16 *src, unsigned width) {
+    for (unsigned x = 0; x < width; ++x) dst[x] = rgb1555_to_rgba(src[x]);
+}
+
+// Every kernel walks rows the same way; only the row function differs.
+#define CONVERT_FRAME(name, row_fn, src_type)                                    \
+    static void name(                                                            \
+        U8 *dst, size_t dst_pitch,                                               \
+        const void *src, size_t src_pitch,                                       \
+        unsigned width, unsigned height                                          \
+    ) {                                                                          \
+        const U8 *s = src;                                                       \
+        for (unsigned y = 0; y < height; ++y) {                                  \
+            row_fn((U32*)(dst + (size_t)y * dst_pitch),                          \
+                (const src_type*)(s + (size_t)y * src_pitch), width);            \
+        }                                                                        \
+    }
+
+CONVERT_FRAME(convert_xrgb8888_scalar, xrgb8888_row_scalar, U32)
+CONVERT_FRAME(convert_rgb565_scalar, rgb565_row_scalar, U16)
+CONVERT_FRAME(convert_rgb1555_scalar, rgb1555_row_scalar, U16)
+
+#if HAVE_X86
+
+// SSE2 #########################################################################
+
+static void xrgb8888_row_sse2(U32 *dst, const U32 *src, unsigned width) {
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+    const __m128i green = _mm_set1_epi32(0x0000FF00);
+    const __m128i low = _mm_set1_epi32(0x000000FF);
+    unsigned x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src + x));
+        __m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), low);
+        __m128i b = _mm_slli_epi32(_mm_and_si128(p, low), 16);
+        __m128i o = _mm_or_si128(_mm_or_si128(alpha, _mm_and_si128(p, green)), _mm_or_si128(r, b));
+        _mm_storeu_si128((__m128i*)(dst + x), o);
+    }
+    xrgb8888_row_scalar(dst + x, src + x, width - x);
+}
+
+// Expands 8 pixels of 5/6-bit channels to R,G,B,A bytes.
+static inline void store_rgba_sse2(U32 *dst, __m128i r5, __m128i g, __m128i b5) {
+    const __m128i alpha = _mm_set1_epi16((short)0xFF00);
+    __m128i r = _mm_or_si128(_mm_slli_epi16(r5, 3), _mm_srli_epi16(r5, 2));
+    __m128i b = _mm_or_si128(_mm_slli_epi16(b5, 3), _mm_srli_epi16(b5, 2));
+    __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+    __m128i ba = _mm_or_si128(b, alpha);
+    _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i*)(dst + 4), _mm_unpackhi_epi16(rg, ba));
+}
+
+static void rgb565_row_sse2(U32 *dst, const U16 *src, unsigned width) {
+    const __m128i mask5 = _mm_set1_epi16(0x1F);
+    const __m128i mask6 = _mm_set1_epi16(0x3F);
+    unsigned x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src + x));
+        __m128i r5 = _mm_srli_epi16(p, 11);
+        __m128i g6 = _mm_and_si128(_mm_srli_epi16(p, 5), mask6);
+        __m128i b5 = _mm_and_si128(p, mask5);
+        __m128i g = _mm_or_si128(_mm_slli_epi16(g6, 2), _mm_srli_epi16(g6, 4));
+        store_rgba_sse2(dst + x, r5, g, b5);
+    }
+    rgb565_row_scalar(dst + x, src + x, width - x);
+}
+
+static void rgb1555_row_sse2(U32 *dst, const U16 *src, unsigned width) {
+    const __m128i mask5 = _mm_set1_epi16(0x1F);
+    unsigned x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src + x));
+        __m128i r5 = _mm_and_si128(_mm_srli_epi16(p, 10), mask5);
+        __m128i g5 = _mm_and_si128(_mm_srli_epi16(p, 5), mask5);
+        __m128i b5 = _mm_and_si128(p, mask5);
+        __m128i g = _mm_or_si128(_mm_slli_epi16(g5, 3), _mm_srli_epi16(g5, 2));
+        store_rgba_sse2(dst + x, r5, g, b5);
+    }
+    rgb1555_row_scalar(dst + x, src + x, width - x);
+}
+
+CONVERT_FRAME(convert_xrgb8888_sse2, xrgb8888_row_sse2, U32)
+CONVERT_FRAME(convert_rgb565_sse2, rgb565_row_sse2, U16)
+CONVERT_FRAME(convert_rgb1555_sse2, rgb1555_row_sse2, U16)
+
+// AVX2 #########################################################################
+
+AVX2 static void xrgb8888_row_avx2(U32 *dst, const U32 *src, unsigned width) {
+    // B,G,R,X -> R,G,B,X per pixel, then force X to 0xFF.
+    const __m256i shuffle = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15
+    );
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000u);
+    unsigned x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i p0 = _mm256_loadu_si256((const __m256i*)(src + x));
+        __m256i p1 = _mm256_loadu_si256((const __m256i*)(src + x + 8));
+        p0 = _mm256_or_si256(_mm256_shuffle_epi8(p0, shuffle), alpha);
+        p1 = _mm256_or_si256(_mm256_shuffle_epi8(p1, shuffle), alpha);
+        _mm256_storeu_si256((__m256i*)(dst + x), p0);
+        _mm256_storeu_si256((__m256i*)(dst + x + 8), p1);
+    }
+    xrgb8888_row_sse2(dst + x, src + x, width - x);
+}
+
+// Expands 16 pixels of 5/6-bit channels to R,G,B,A bytes. unpack works within
+// 128-bit lanes, so the halves are put back in pixel order with permute2x128.
+AVX2 static inline void store_rgba_avx2(U32 *dst, __m256i r5, __m256i g, __m256i b5) {
+    const __m256i alpha = _mm256_set1_epi16((short)0xFF00);
+    __m256i r = _mm256_or_si256(_mm256_slli_epi16(r5, 3), _mm256_srli_epi16(r5, 2));
+    __m256i b = _mm256_or_si256(_mm256_slli_epi16(b5, 3), _mm256_srli_epi16(b5, 2));
+    __m256i rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+    __m256i ba = _mm256_or_si256(b, alpha);
+    __m256i lo = _mm256_unpacklo_epi16(rg, ba);
+    __m256i hi = _mm256_unpackhi_epi16(rg, ba);
+    _mm256_storeu_si256((__m256i*)dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i*)(dst + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+AVX2 static void rgb565_row_avx2(U32 *dst, const U16 *src, unsigned width) {
+    const __m256i mask5 = _mm256_set1_epi16(0x1F);
+    const __m256i mask6 = _mm256_set1_epi16(0x3F);
+    unsigned x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(src + x));
+        __m256i r5 = _mm256_srli_epi16(p, 11);
+        __m256i g6 = _mm256_and_si256(_mm256_srli_epi16(p, 5), mask6);
+        __m256i b5 = _mm256_and_si256(p, mask5);
+        __m256i g = _mm256_or_si256(_mm256_slli_epi16(g6, 2), _mm256_srli_epi16(g6, 4));
+        store_rgba_avx2(dst + x, r5, g, b5);
+    }
+    rgb565_row_sse2(dst + x, src + x, width - x);
+}
+
+AVX2 static void rgb1555_row_avx2(U32 *dst, const U16 *src, unsigned width) {
+    const __m256i mask5 = _mm256_set1_epi16(0x1F);
+    unsigned x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(src + x));
+        __m256i r5 = _mm256_and_si256(_mm256_srli_epi16(p, 10), mask5);
+        __m256i g5 = _mm256_and_si256(_mm256_srli_epi16(p, 5), mask5);
+        __m256i b5 = _mm256_and_si256(p, mask5);
+        __m256i g = _mm256_or_si256(_mm256_slli_epi16(g5, 3), _mm256_srli_epi16(g5, 2));
+        store_rgba_avx2(dst + x, r5, g, b5);
+    }
+    rgb1555_row_sse2(dst + x, src + x, width - x);
+}
+
+AVX2 CONVERT_FRAME(convert_xrgb8888_avx2, xrgb8888_row_avx2, U32)
+AVX2 CONVERT_FRAME(convert_rgb565_avx2, rgb565_row_avx2, U16)
+AVX2 CONVERT_FRAME(convert_rgb1555_avx2, rgb1555_row_avx2, U16)
+
+#endif
+
+// SELECTION ####################################################################
+
+// Ordered from most to least preferred within each format.
+const ConvertKernel convert_kernels[] = {
+#if HAVE_X86
+    { "xrgb8888_avx2", RETRO_PIXEL_FORMAT_XRGB8888, CONVERT_AVX2,   convert_xrgb8888_avx2 },
+    { "xrgb8888_sse2", RETRO_PIXEL_FORMAT_XRGB8888, CONVERT_SSE2,   convert_xrgb8888_sse2 },
+#endif
+    { "xrgb8888",      RETRO_PIXEL_FORMAT_XRGB8888, CONVERT_SCALAR, convert_xrgb8888_scalar },
+#if HAVE_X86
+    { "rgb565_avx2",   RETRO_PIXEL_FORMAT_RGB565,   CONVERT_AVX2,   convert_rgb565_avx2 },
+    { "rgb565_sse2",   RETRO_PIXEL_FORMAT_RGB565,   CONVERT_SSE2,   convert_rgb565_sse2 },
+#endif
+    { "rgb565",        RETRO_PIXEL_FORMAT_RGB565,   CONVERT_SCALAR, convert_rgb565_scalar },
+#if HAVE_X86
+    { "0rgb1555_avx2", RETRO_PIXEL_FORMAT_0RGB1555, CONVERT_AVX2,   convert_rgb1555_avx2 },
+    { "0rgb1555_sse2", RETRO_PIXEL_FORMAT_0RGB1555, CONVERT_SSE2,   convert_rgb1555_sse2 },
+#endif
+    { "0rgb1555",      RETRO_PIXEL_FORMAT_0RGB1555, CONVERT_SCALAR, convert_rgb1555_scalar },
+};
+const size_t convert_kernel_count = sizeof(convert_kernels) / sizeof(convert_kernels[0]);
+
+bool convert_isa_supported(ConvertIsa isa) {
+    switch (isa) {
+    case CONVERT_SCALAR:
+        return true;
+#if HAVE_X86
+    case CONVERT_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case CONVERT_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+ConvertFn convert_select(enum retro_pixel_format format) {
+    // libretro's default format when the core never sets one.
+    if (format == RETRO_PIXEL_FORMAT_UNKNOWN) format = RETRO_PIXEL_FORMAT_0RGB1555;
+
+    for (size_t i = 0; i < convert_kernel_count; ++i) {
+        const ConvertKernel *k = &convert_kernels[i];
+        if (k->format == format && convert_isa_supported(k->isa))
+            return k->fn;
+    }
+    return NULL;
+}
@@ -0,0 +1,38 @@
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include "libretro.h"
+#include "types.h"
+
+// Converts a frame in one of the libretro pixel formats to tightly or loosely
+// packed RGBA8 (R, G, B, A byte order, alpha forced to 0xFF), honoring the
+// source and destination pitch.
+typedef void (*ConvertFn)(
+    U8 *dst, size_t dst_pitch,
+    const void *src, size_t src_pitch,
+    unsigned width, unsigned height
+);
+
+typedef enum ConvertIsa {
+    CONVERT_SCALAR,
+    CONVERT_SSE2,
+    CONVERT_AVX2,
+} ConvertIsa;
+
+typedef struct ConvertKernel {
+    const char *name;
+    enum retro_pixel_format format;
+    ConvertIsa isa;
+    ConvertFn fn;
+} ConvertKernel;
+
+extern const ConvertKernel convert_kernels[];
+extern const size_t convert_kernel_count;
+
+bool convert_isa_supported(ConvertIsa isa);
+
+// Best supported kernel for the format, or NULL for an unknown format.
+// Meant to be called once when the core sets its pixel format.
+ConvertFn convert_select(enum retro_pixel_format format);
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef WIN32
+  // for dlmopen
+  #define _GNU_SOURCE
+#endif
+#include "core.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+static core_functions_t *load_symbols(LIBHANDLE libhandle) {
+    core_functions_t *fns = malloc(sizeof(core_functions_t));
+    
+    fns->core_init                            = (core_action_fnt)                 LOAD_SYMBOL(libhandle, "retro_init");
+    fns->core_deinit                          = (core_action_fnt)                 LOAD_SYMBOL(libhandle, "retro_deinit");
+    fns->core_run                             = (core_action_fnt)                 LOAD_SYMBOL(libhandle, "retro_run");
+    fns->core_reset                           = (core_action_fnt)                 LOAD_SYMBOL(libhandle, "retro_reset");
+    fns->core_get_info                        = (core_info_fnt)                   LOAD_SYMBOL(libhandle, "retro_get_system_info");
+    fns->core_load_game                       = (core_loadg_fnt)                  LOAD_SYMBOL(libhandle, "retro_load_game");
+    fns->core_unload_game                     = (core_unloadg_fnt)                LOAD_SYMBOL(libhandle, "retro_unload_game");
+
+    fns->core_set_env_function                = (core_set_environment_fnt)        LOAD_SYMBOL(libhandle, "retro_set_environment");
+    fns->core_set_video_refresh_function      = (core_set_video_refresh_fnt)      LOAD_SYMBOL(libhandle, "retro_set_video_refresh");
+    fns->core_set_audio_sample_function       = (core_set_audio_sample_fnt)       LOAD_SYMBOL(libhandle, "retro_set_audio_sample");
+    fns->core_set_audio_sample_batch_function = (core_set_audio_sample_batch_fnt) LOAD_SYMBOL(libhandle, "retro_set_audio_sample_batch");
+    fns->core_set_input_poll_function         = (core_set_input_poll_fnt)         LOAD_SYMBOL(libhandle, "retro_set_input_poll");
+    fns->core_set_input_state_function        = (core_set_input_state_fnt)        LOAD_SYMBOL(libhandle, "retro_set_input_state");
+
+    fns->core_serialize                       = (core_serialize_fnt)              LOAD_SYMBOL(libhandle, "retro_serialize");
+    fns->core_serialize_size                  = (core_serialize_size_fnt)         LOAD_SYMBOL(libhandle, "retro_serialize_size");
+    fns->core_unserialize                     = (core_unserialize_fnt)            LOAD_SYMBOL(libhandle, "retro_unserialize");
+    fns->core_get_system_av_info              = (core_get_system_av_info_fnt)     LOAD_SYMBOL(libhandle, "retro_get_system_av_info");
+    fns->core_get_memory_data                 = (core_get_memory_data_fnt)        LOAD_SYMBOL(libhandle, "retro_get_memory_data");
+    fns->core_get_memory_size                 = (core_get_memory_size_fnt)        LOAD_SYMBOL(libhandle, "retro_get_memory_size");
+    fns->handle = libhandle;
+
+    return fns;
+}
+
+core_functions_t *load_core(const char *filename) {
+    LIBHANDLE libhandle = LOAD_LIBRARY(filename);
+    if (!libhandle)
+        return NULL;
+    return load_symbols(libhandle);
+}
+
+void unload_core(core_functions_t *core) {
+    UNLOAD_LIBRARY(core->handle);
+    free(core);
+}
+
+bool load_game(core_functions_t *core, const char *path, Bytes *iso) {
+    struct retro_system_info sysinfo = { 0 };
+    core->core_get_info(&sysinfo);
+    printf("core %s %s\n", sysinfo.library_name, sysinfo.library_version);
+
+    // Cores with need_fullpath (Dolphin included) open the image themselves,
+    // so only map it for cores that want it in memory.
+    if (sysinfo.need_fullpath) {
+        if (access(path, R_OK) != 0) {
+            fprintf(stderr, "could not open %s: %s\n", path, strerror(errno));
+            return false;
+        }
+    } else if (iso->ptr == NULL) {
+        *iso = map_file(path);
+        if (iso->ptr == NULL) {
+            fprintf(stderr, "could not map %s: %s\n", path, strerror(errno));
+            return false;
+        }
+    }
+
+    struct retro_game_info gameinfo = {
+        .path = path,
+        .data = sysinfo.need_fullpath ? NULL : iso->ptr,
+        .size = sysinfo.need_fullpath ? 0 : iso->size,
+        .meta = NULL
+    };
+    if (!core->core_load_game(&gameinfo)) {
+        fprintf(stderr, "core could not load %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+#ifdef WIN32
+
+core_functions_t *load_core_isolated(const char *filename) {
+    (void)filename;
+    return NULL;
+}
+
+#else
+
+static bool copy_fd(int in, int out) {
+    char buf[1 << 16];
+    for (;;) {
+        ssize_t n = read(in, buf, sizeof(buf));
+        if (n == 0) return true;
+        if (n < 0) return false;
+        for (ssize_t done = 0; done < n;) {
+            ssize_t w = write(out, buf + done, (size_t)(n - done));
+            if (w <= 0) return false;
+            done += w;
+        }
+    }
+}
+
+static core_functions_t *load_core_copy(const char *filename) {
+    int in = open(filename, O_RDONLY | O_CLOEXEC);
+    if (in < 0) return NULL;
+
+    char path[] = "/tmp/dolphin_embed_core_XXXXXX";
+    int out = mkstemp(path);
+    if (out < 0) {
+        close(in);
+        return NULL;
+    }
+
+    bool copied = copy_fd(in, out);
+    close(in);
+    close(out);
+
+    core_functions_t *core = copied ? load_core(path) : NULL;
+    // The mapping keeps the file alive; nothing else needs the path.
+    unlink(path);
+    return core;
+}
+
+core_functions_t *load_core_isolated(const char *filename) {
+    // A new link-map namespace gets its own copy of the core and everything
+    // it links against, with no file written. glibc only has a handful of
+    // namespaces to give out, so past that the core is copied instead.
+    LIBHANDLE libhandle = dlmopen(LM_ID_NEWLM, filename, RTLD_LAZY | RTLD_LOCAL);
+    if (libhandle)
+        return load_symbols(libhandle);
+    return load_core_copy(filename);
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef CORE_H
+#define CORE_H
+
+#include "libretro.h"
+#include "file.h"
+
+// CORE LOADING #################################################################
+// taken from https://github.com/davidgfnet/miniretro
+
+#ifdef WIN32
+  #include <windows.h>
+  #define LIBHANDLE HMODULE
+  #define LOAD_LIBRARY(path) LoadLibraryA(path)
+  #define UNLOAD_LIBRARY(lib) FreeLibrary(lib)
+  #define LOAD_SYMBOL(lib, name) GetProcAddress(lib, name)
+#else
+  #include <dlfcn.h>
+  #define LIBHANDLE void*
+  #define LOAD_LIBRARY(path) dlopen(path, RTLD_LAZY | RTLD_LOCAL)
+  #define UNLOAD_LIBRARY(lib) dlclose(lib)
+  #define LOAD_SYMBOL(lib, name) dlsym(lib, name)
+#endif
+
+typedef RETRO_CALLCONV void (*core_info_fnt)(struct retro_system_info *info);
+typedef RETRO_CALLCONV void (*core_action_fnt)(void);
+typedef RETRO_CALLCONV bool (*core_loadg_fnt)(const struct retro_game_info *game);
+typedef RETRO_CALLCONV void (*core_unloadg_fnt)(void);
+typedef RETRO_CALLCONV void (*core_set_environment_fnt)(retro_environment_t);
+typedef RETRO_CALLCONV void (*core_set_video_refresh_fnt)(retro_video_refresh_t);
+typedef RETRO_CALLCONV void (*core_set_audio_sample_fnt)(retro_audio_sample_t);
+typedef RETRO_CALLCONV void (*core_set_audio_sample_batch_fnt)(retro_audio_sample_batch_t);
+typedef RETRO_CALLCONV void (*core_set_input_poll_fnt)(retro_input_poll_t);
+typedef RETRO_CALLCONV void (*core_set_input_state_fnt)(retro_input_state_t);
+typedef RETRO_CALLCONV bool (*core_serialize_fnt)(void *data, size_t size);
+typedef RETRO_CALLCONV size_t (*core_serialize_size_fnt)(void);
+typedef RETRO_CALLCONV bool (*core_unserialize_fnt)(const void *data, size_t size);
+typedef RETRO_CALLCONV void (*core_get_system_av_info_fnt)(struct retro_system_av_info *info);
+typedef RETRO_CALLCONV void *(*core_get_memory_data_fnt)(unsigned id);
+typedef RETRO_CALLCONV size_t (*core_get_memory_size_fnt)(unsigned id);
+
+typedef struct {
+    core_action_fnt core_init;
+    core_action_fnt core_deinit;
+    core_action_fnt core_run;
+    core_action_fnt core_reset;
+    core_info_fnt   core_get_info;
+    core_loadg_fnt  core_load_game;
+    core_unloadg_fnt core_unload_game;
+    core_set_environment_fnt core_set_env_function;
+    core_set_video_refresh_fnt core_set_video_refresh_function;
+    core_set_audio_sample_fnt core_set_audio_sample_function;
+    core_set_audio_sample_batch_fnt core_set_audio_sample_batch_function;
+    core_set_input_poll_fnt core_set_input_poll_function;
+    core_set_input_state_fnt core_set_input_state_function;
+    core_serialize_fnt core_serialize;
+    core_serialize_size_fnt core_serialize_size;
+    core_unserialize_fnt core_unserialize;
+    core_get_system_av_info_fnt core_get_system_av_info;
+    core_get_memory_data_fnt core_get_memory_data;
+    core_get_memory_size_fnt core_get_memory_size;
+
+    LIBHANDLE handle;
+} core_functions_t;
+
+core_functions_t *load_core(const char *filename);
+void unload_core(core_functions_t *core);
+
+// Loads another, independent instance of a core. dlopen hands back the
+// already loaded instance for a path it has seen, and cores keep their state
+// in globals, so the core is loaded into a fresh dlmopen namespace, or from a
+// temporary copy of the library once namespaces run out. Returns NULL on
+// failure.
+core_functions_t *load_core_isolated(const char *filename);
+
+// Loads the game into an initialized core. The image is mapped into *iso on
+// first use and shared by every instance after that. Prints why on failure.
+bool load_game(core_functions_t *core, const char *path, Bytes *iso);
+
+#endif
@@ -0,0 +1,102 @@
+#include "delta.h"
+
+#include <string.h>
+
+// Unchanged stretches shorter than this stay inside the changed run; a run
+// header costs about as much as the bytes it would skip.
+#define DELTA_MIN_SKIP 16
+
+static inline U64 read64(const U8 *p) {
+    U64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline bool same16(const U8 *a, const U8 *b) {
+    return read64(a) == read64(b) && read64(a + 8) == read64(b + 8);
+}
+
+static size_t put_varint(U8 *out, U64 v) {
+    size_t n = 0;
+    do {
+        U8 byte = v & 0x7F;
+        v >>= 7;
+        out[n++] = v ? (byte | 0x80) : byte;
+    } while (v);
+    return n;
+}
+
+static bool get_varint(const U8 *in, size_t in_size, size_t *pos, U64 *v) {
+    *v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (*pos >= in_size) return false;
+        U8 byte = in[(*pos)++];
+        *v |= (U64)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+size_t delta_bound(size_t size) {
+    // One run covering everything, with two maximal varints.
+    return size + 20;
+}
+
+size_t delta_encode(U8 *out, size_t out_size, const U8 *cur, const U8 *base, size_t size) {
+    size_t n = 0;
+    size_t i = 0;
+
+    while (i < size) {
+        size_t skip_start = i;
+        while (i + 8 <= size && read64(cur + i) == read64(base + i)) i += 8;
+        while (i < size && cur[i] == base[i]) i++;
+        if (i == size) break;
+
+        size_t lit_start = i;
+        while (i < size) {
+            if (i + DELTA_MIN_SKIP <= size && same16(cur + i, base + i)) break;
+            if (i + 8 <= size && read64(cur + i) != read64(base + i)) i += 8;
+            else i++;
+        }
+
+        size_t skip = lit_start - skip_start;
+        size_t lit = i - lit_start;
+        if (n + 20 + lit > out_size) return 0;
+        n += put_varint(out + n, skip);
+        n += put_varint(out + n, lit);
+
+        size_t k = 0;
+        for (; k + 8 <= lit; k += 8) {
+            U64 x = read64(cur + lit_start + k) ^ read64(base + lit_start + k);
+            memcpy(out + n + k, &x, 8);
+        }
+        for (; k < lit; ++k) out[n + k] = cur[lit_start + k] ^ base[lit_start + k];
+        n += lit;
+    }
+
+    return n;
+}
+
+bool delta_decode(U8 *dst, const U8 *base, size_t size, const U8 *in, size_t in_size) {
+    if (dst != base) memcpy(dst, base, size);
+
+    size_t pos = 0;
+    size_t at = 0;
+    while (pos < in_size) {
+        U64 skip, lit;
+        if (!get_varint(in, in_size, &pos, &skip)) return false;
+        if (!get_varint(in, in_size, &pos, &lit)) return false;
+        if (skip > size - at || lit > size - at - skip || lit > in_size - pos) return false;
+        at += skip;
+
+        size_t k = 0;
+        for (; k + 8 <= lit; k += 8) {
+            U64 x = read64(dst + at + k) ^ read64(in + pos + k);
+            memcpy(dst + at + k, &x, 8);
+        }
+        for (; k < lit; ++k) dst[at + k] ^= in[pos + k];
+        at += lit;
+        pos += lit;
+    }
+    return true;
+}
@@ -0,0 +1,22 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "types.h"
+
+// XOR delta of a buffer against a base of the same size, with runs of
+// unchanged bytes collapsed. Savestates of nearby frames differ in a small
+// fraction of their bytes, so deltas are usually tiny.
+//
+// Encoded as repeated (varint unchanged bytes, varint changed bytes,
+// changed bytes XOR base). Trailing unchanged bytes are implicit.
+
+// Upper bound on the encoded size of a size byte buffer.
+size_t delta_bound(size_t size);
+
+// Returns the encoded size, or 0 if it would exceed out_size.
+size_t delta_encode(U8 *out, size_t out_size, const U8 *cur, const U8 *base, size_t size);
+
+// Rebuilds cur into dst. dst may alias base. Returns false on corrupt input.
+bool delta_decode(U8 *dst, const U8 *base, size_t size, const U8 *in, size_t in_size);
+
+#endif
@@ -0,0 +1,318 @@
+#include "env.h"
+#include "core.h"
+#include "convert.h"
+#include "file.h"
+#include "memmap.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Env {
+    core_functions_t *core;
+    ConvertFn convert;
+    int av_enable;
+
+    // The core's last frame, converted to the observation size while the
+    // core's buffer was still valid.
+    U8 *observation;
+    bool observed;
+    bool loaded;
+
+    MemoryMap memory;
+    U8 *reset_state;
+} Env;
+
+struct Envs {
+    Env *envs;
+    unsigned count;
+    unsigned frame_skip;
+    const char *system_dir;
+    const char *save_dir;
+    size_t state_size;
+    U8 *scratch_state;       // for env_save_state and env_load_state
+    unsigned width;
+    unsigned height;
+    Bytes iso;
+};
+
+// Cores call back without any context, so the environment being driven is
+// tracked here. Every call into a core goes through the calling thread.
+static Envs *current_envs;
+static Env *current;
+
+// CALLBACKS ####################################################################
+
+static void RETRO_CALLCONV env_log(enum retro_log_level level, const char *fmt, ...) {
+    if (level < RETRO_LOG_WARN) return;
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+static bool RETRO_CALLCONV env_environment(unsigned cmd, void *data) {
+    switch (cmd) {
+    case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+        current->convert = convert_select(*(enum retro_pixel_format*)data);
+        return current->convert != NULL;
+    case RETRO_ENVIRONMENT_GET_INPUT_BITMASKS:
+        return true;
+    case RETRO_ENVIRONMENT_GET_CAN_DUPE:
+        // A dupe after a reset or a state load would leave the observation black.
+        *(bool*)data = false;
+        return true;
+    case RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY:
+        *(const char**)data = current_envs->system_dir;
+        return current_envs->system_dir != NULL;
+    case RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY:
+        *(const char**)data = current_envs->save_dir;
+        return current_envs->save_dir != NULL;
+    case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
+        ((struct retro_log_callback*)data)->log = &env_log;
+        return true;
+    case RETRO_ENVIRONMENT_SET_MEMORY_MAPS:
+        return memmap_set(&current->memory, data);
+    case RETRO_ENVIRONMENT_SET_GEOMETRY:
+    case RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO:
+        return true;
+    case RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE:
+        if (data != NULL)
+            *(int*)data = current->av_enable;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// libretro only guarantees the frame for the duration of this call, so it is
+// converted into the observation here rather than in env_observe.
+static void RETRO_CALLCONV env_video(const void *data, unsigned width, unsigned height, size_t pitch) {
+    if (data == NULL || data == RETRO_HW_FRAME_BUFFER_VALID || !(current->av_enable & RETRO_AV_ENABLE_VIDEO)
+        || current->convert == NULL || current->observation == NULL)
+        return;
+
+    const Envs *envs = current_envs;
+    unsigned w = width < envs->width ? width : envs->width;
+    unsigned h = height < envs->height ? height : envs->height;
+    if (w != envs->width || h != envs->height)
+        memset(current->observation, 0, env_observation_size(envs, NULL, NULL));
+    current->convert(current->observation, (size_t)envs->width * 4, data, pitch, w, h);
+    current->observed = true;
+}
+
+static void RETRO_CALLCONV env_audio(int16_t left, int16_t right) {
+    (void)left;
+    (void)right;
+}
+
+static size_t RETRO_CALLCONV env_audio_batch(const int16_t *data, size_t frames) {
+    (void)data;
+    return frames;
+}
+
+// ENVIRONMENTS #################################################################
+
+static void run_frames(Env *env, unsigned frames) {
+    current = env;
+    for (unsigned i = 0; i < frames; ++i) {
+        // Only the frame that will be observed needs rendering.
+        env->av_enable = i + 1 == frames ? RETRO_AV_ENABLE_VIDEO : 0;
+        env->core->core_run();
+    }
+}
+
+static bool start_env(Envs *envs, Env *env, const EnvConfig *config, bool first) {
+    // Isolated even for the first so a second batch in this process stays apart.
+    env->core = load_core_isolated(config->core_path);
+    if (env->core == NULL) {
+        fprintf(stderr, "could not load core %s\n", config->core_path);
+        return false;
+    }
+
+    current = env;
+    env->convert = convert_select(RETRO_PIXEL_FORMAT_0RGB1555);
+    core_functions_t *core = env->core;
+    core->core_set_env_function(&env_environment);
+    core->core_set_video_refresh_function(&env_video);
+    core->core_set_audio_sample_function(&env_audio);
+    core->core_set_audio_sample_batch_function(&env_audio_batch);
+    core->core_set_input_poll_function(&input_poll);
+    core->core_set_input_state_function(&input_state);
+    core->core_init();
+    if (!load_game(core, config->iso_path, &envs->iso)) return false;
+    env->loaded = true;
+
+    if (first) {
+        struct retro_system_av_info av_info;
+        core->core_get_system_av_info(&av_info);
+        envs->width = av_info.geometry.base_width;
+        envs->height = av_info.geometry.base_height;
+        envs->state_size = core->core_serialize_size();
+        if (envs->state_size == 0) {
+            fprintf(stderr, "core does not support savestates, environments can't be reset\n");
+            return false;
+        }
+    }
+
+    env->observation = malloc(env_observation_size(envs, NULL, NULL));
+    if (env->observation == NULL) {
+        fprintf(stderr, "could not allocate an observation\n");
+        return false;
+    }
+
+    if (config->warmup_frames != 0) {
+        const InputSnapshot idle = { 0 };
+        input_publish(&idle);
+        run_frames(env, config->warmup_frames);
+    }
+
+    env->reset_state = malloc(envs->state_size);
+    if (env->reset_state == NULL || !core->core_serialize(env->reset_state, envs->state_size)) {
+        fprintf(stderr, "could not take the reset state\n");
+        return false;
+    }
+    return true;
+}
+
+Envs *env_create(const EnvConfig *config) {
+    if (config->count == 0) {
+        fprintf(stderr, "no environments requested\n");
+        return NULL;
+    }
+
+    Envs *envs = calloc(1, sizeof(Envs));
+    if (envs != NULL) envs->envs = calloc(config->count, sizeof(Env));
+    if (envs == NULL || envs->envs == NULL) {
+        fprintf(stderr, "could not allocate %u environments\n", config->count);
+        free(envs);
+        return NULL;
+    }
+    envs->frame_skip = config->frame_skip ? config->frame_skip : 1;
+    envs->system_dir = config->system_dir;
+    envs->save_dir = config->save_dir;
+
+    current_envs = envs;
+    for (unsigned i = 0; i < config->count; ++i) {
+        envs->count = i + 1;
+        if (!start_env(envs, &envs->envs[i], config, i == 0)) {
+            env_destroy(envs);
+            return NULL;
+        }
+    }
+    return envs;
+}
+
+void env_destroy(Envs *envs) {
+    if (envs == NULL) return;
+    current_envs = envs;
+    for (unsigned i = 0; i < envs->count; ++i) {
+        Env *env = &envs->envs[i];
+        if (env->core != NULL) {
+            current = env;
+            // A core whose game failed to load was still initialized.
+            if (env->loaded) env->core->core_unload_game();
+            env->core->core_deinit();
+            unload_core(env->core);
+        }
+        memmap_clear(&env->memory);
+        free(env->observation);
+        free(env->reset_state);
+    }
+    unmap_file(envs->iso);
+    free(envs->scratch_state);
+    free(envs->envs);
+    free(envs);
+    current_envs = NULL;
+    current = NULL;
+}
+
+size_t env_observation_size(const Envs *envs, unsigned *width, unsigned *height) {
+    if (width != NULL) *width = envs->width;
+    if (height != NULL) *height = envs->height;
+    return (size_t)envs->width * envs->height * 4;
+}
+
+bool env_reset(Envs *envs) {
+    current_envs = envs;
+    bool ok = true;
+    for (unsigned i = 0; i < envs->count; ++i) {
+        Env *env = &envs->envs[i];
+        current = env;
+        // The frame from before the reset belongs to a state that's gone.
+        env->observed = false;
+        ok = env->core->core_unserialize(env->reset_state, envs->state_size) && ok;
+    }
+    return ok;
+}
+
+bool env_step(Envs *envs, const InputSnapshot actions[], unsigned n_envs) {
+    if (n_envs > envs->count) return false;
+    current_envs = envs;
+    for (unsigned i = 0; i < n_envs; ++i) {
+        // Snapshots are picked up at the core's next input poll.
+        input_publish(&actions[i]);
+        run_frames(&envs->envs[i], envs->frame_skip);
+    }
+    return true;
+}
+
+void env_observe(const Envs *envs, U8 *out, unsigned n_envs) {
+    size_t size = env_observation_size(envs, NULL, NULL);
+    for (unsigned i = 0; i < n_envs && i < envs->count; ++i) {
+        const Env *env = &envs->envs[i];
+        U8 *dst = out + size * i;
+        if (env->observed) memcpy(dst, env->observation, size);
+        else memset(dst, 0, size);
+    }
+}
+
+bool env_save_state(Envs *envs, unsigned i, ChunkStore *store, U64 *id) {
+    if (i >= envs->count) return false;
+    if (envs->scratch_state == NULL && (envs->scratch_state = malloc(envs->state_size)) == NULL)
+        return false;
+    current_envs = envs;
+    current = &envs->envs[i];
+    return current->core->core_serialize(envs->scratch_state, envs->state_size)
+        && chunkstore_put(store, envs->scratch_state, envs->state_size, id);
+}
+
+bool env_load_state(Envs *envs, unsigned i, ChunkStore *store, U64 id) {
+    if (i >= envs->count) return false;
+    if (envs->scratch_state == NULL && (envs->scratch_state = malloc(envs->state_size)) == NULL)
+        return false;
+    if (!chunkstore_get(store, id, envs->scratch_state, envs->state_size)) return false;
+    current_envs = envs;
+    current = &envs->envs[i];
+    current->observed = false;
+    return current->core->core_unserialize(envs->scratch_state, envs->state_size);
+}
+
+bool env_tree_init(Envs *envs, unsigned i, StateTree *tree, size_t budget) {
+    if (i >= envs->count) return false;
+    current_envs = envs;
+    current = &envs->envs[i];
+    return statetree_init(tree, current->core, budget, envs->frame_skip, &current->av_enable);
+}
+
+StateNode env_tree_branch(Envs *envs, unsigned i, StateTree *tree, StateNode parent,
+    const InputSnapshot actions[], U32 count
+) {
+    if (i >= envs->count) return STATETREE_NONE;
+    current_envs = envs;
+    current = &envs->envs[i];
+    return statetree_branch(tree, parent, actions, count);
+}
+
+bool env_tree_restore(Envs *envs, unsigned i, StateTree *tree, StateNode node) {
+    if (i >= envs->count) return false;
+    current_envs = envs;
+    current = &envs->envs[i];
+    current->observed = false;
+    return statetree_restore(tree, node);
+}
+
+const MemoryMap *env_memory(const Envs *envs, unsigned i) {
+    return i < envs->count ? &envs->envs[i].memory : NULL;
+}
@@ -0,0 +1,72 @@
+#ifndef ENV_H
+#define ENV_H
+
+#include "chunkstore.h"
+#include "input.h"
+#include "memmap.h"
+#include "statetree.h"
+#include "types.h"
+
+// Batched environments for training agents, built as libdolphin_embed without
+// a window or audio device. Every environment is its own instance of the core
+// in its own link-map namespace, loaded from a private copy of the library
+// only when dlmopen fails, and all of them are stepped from the calling
+// thread. Each core's frame is converted to RGBA8 while the core hands it
+// over, the only time libretro guarantees it, and env_observe copies the
+// converted frames out. Stepping makes no syscalls of its own.
+
+typedef struct EnvConfig {
+    const char *core_path;
+    const char *iso_path;
+    const char *system_dir;  // may be NULL
+    const char *save_dir;    // may be NULL
+    unsigned count;
+    unsigned frame_skip;     // core frames per step, the action is held for all of them
+    unsigned warmup_frames;  // frames run after boot before the reset state is taken
+} EnvConfig;
+
+typedef struct Envs Envs;
+
+// Returns NULL on failure, after printing why.
+Envs *env_create(const EnvConfig *config);
+void env_destroy(Envs *envs);
+
+// Observations are RGBA8 frames of width * height pixels, packed one after
+// another. Returns the size of one in bytes.
+size_t env_observation_size(const Envs *envs, unsigned *width, unsigned *height);
+
+// Restores every environment to the state taken after warmup.
+bool env_reset(Envs *envs);
+
+// Steps the first n_envs environments, each with its own action.
+bool env_step(Envs *envs, const InputSnapshot actions[], unsigned n_envs);
+
+// Writes the latest frame of the first n_envs environments to out, which must
+// hold n_envs * env_observation_size bytes. Frames of a different size than
+// the observation are clipped or padded with black.
+void env_observe(const Envs *envs, U8 *out, unsigned n_envs);
+
+// Saves environment i into a chunk store, for keeping large sets of start
+// positions, and returns the state's id in the store.
+bool env_save_state(Envs *envs, unsigned i, ChunkStore *store, U64 *id);
+
+// Loads a state saved with env_save_state into environment i.
+bool env_load_state(Envs *envs, unsigned i, ChunkStore *store, U64 id);
+
+// A tree of savestates (statetree.h) for searching from environment i. Its
+// inputs are actions, each held for frame_skip frames as in env_step.
+bool env_tree_init(Envs *envs, unsigned i, StateTree *tree, size_t budget);
+
+// Adds environment i's state as a child of parent, reached from parent by
+// stepping actions[0..count).
+StateNode env_tree_branch(Envs *envs, unsigned i, StateTree *tree, StateNode parent,
+    const InputSnapshot actions[], U32 count);
+
+// Puts environment i in node's state. Its observation is only current if the
+// node had to be replayed, otherwise it is black until the next step.
+bool env_tree_restore(Envs *envs, unsigned i, StateTree *tree, StateNode node);
+
+// Guest memory of one environment, for reading game state between steps.
+const MemoryMap *env_memory(const Envs *envs, unsigned i);
+
+#endif
@@ -0,0 +1,257 @@
+#include "extract.h"
+#include "input.h"
+#include "simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MELEE_PLAYER_BLOCK 0x80453080u
+#define MELEE_PLAYER_STRIDE 0xE90u
+
+const FieldDef melee_fields[] = {
+    { "character",    MELEE_PLAYER_BLOCK + 0x04, MELEE_PLAYER_STRIDE, 0, { 0 }, FIELD_U32 },
+    { "x",            MELEE_PLAYER_BLOCK + 0x10, MELEE_PLAYER_STRIDE, 0, { 0 }, FIELD_F32 },
+    { "y",            MELEE_PLAYER_BLOCK + 0x14, MELEE_PLAYER_STRIDE, 0, { 0 }, FIELD_F32 },
+    { "percent",      MELEE_PLAYER_BLOCK + 0x60, MELEE_PLAYER_STRIDE, 0, { 0 }, FIELD_U16 },
+    { "stocks",       MELEE_PLAYER_BLOCK + 0x8E, MELEE_PLAYER_STRIDE, 0, { 0 }, FIELD_U8 },
+    // static block -> entity -> entity data -> action state
+    { "action_state", MELEE_PLAYER_BLOCK + 0xB0, MELEE_PLAYER_STRIDE, 2, { 0x2C, 0x10 }, FIELD_U32 },
+};
+const size_t melee_field_count = sizeof(melee_fields) / sizeof(melee_fields[0]);
+
+static unsigned field_width(FieldType type) {
+    switch (type) {
+    case FIELD_U8:  return 1;
+    case FIELD_U16: return 2;
+    case FIELD_U64: return 8;
+    default:        return 4;
+    }
+}
+
+// BYTE SWAP ####################################################################
+
+typedef void (*SwapFn)(U8 *p, size_t count);
+
+static void swap16_scalar(U8 *p, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        U16 v;
+        memcpy(&v, p + i * 2, 2);
+        v = __builtin_bswap16(v);
+        memcpy(p + i * 2, &v, 2);
+    }
+}
+
+static void swap32_scalar(U8 *p, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        U32 v;
+        memcpy(&v, p + i * 4, 4);
+        v = __builtin_bswap32(v);
+        memcpy(p + i * 4, &v, 4);
+    }
+}
+
+#if HAVE_X86
+
+AVX2 static void swap16_avx2(U8 *p, size_t count) {
+    const __m256i shuffle = _mm256_setr_epi8(
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i * 2));
+        _mm256_storeu_si256((__m256i*)(p + i * 2), _mm256_shuffle_epi8(v, shuffle));
+    }
+    swap16_scalar(p + i * 2, count - i);
+}
+
+AVX2 static void swap32_avx2(U8 *p, size_t count) {
+    const __m256i shuffle = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i * 4));
+        _mm256_storeu_si256((__m256i*)(p + i * 4), _mm256_shuffle_epi8(v, shuffle));
+    }
+    swap32_scalar(p + i * 4, count - i);
+}
+
+#endif
+
+static SwapFn swap16 = swap16_scalar;
+static SwapFn swap32 = swap32_scalar;
+
+static void swap_select(void) {
+#if HAVE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        swap16 = swap16_avx2;
+        swap32 = swap32_avx2;
+    }
+#endif
+}
+
+// FILE #########################################################################
+
+static bool write_header(Extractor *x) {
+    U8 header[8];
+    memcpy(header, EXTRACT_MAGIC, 4);
+    header[4] = (U8)EXTRACT_VERSION;
+    header[5] = (U8)(EXTRACT_VERSION >> 8);
+    header[6] = (U8)x->column_count;
+    header[7] = (U8)(x->column_count >> 8);
+    if (fwrite(header, sizeof(header), 1, x->f) != 1) return false;
+
+    for (unsigned i = 0; i < x->column_count; ++i) {
+        const ExtractColumn *c = &x->columns[i];
+        U8 len = (U8)strlen(c->name);
+        U8 desc[2] = { (U8)c->type, len };
+        if (fwrite(desc, sizeof(desc), 1, x->f) != 1 || fwrite(c->name, len, 1, x->f) != 1)
+            return false;
+    }
+    return true;
+}
+
+static bool flush_chunk(Extractor *x) {
+    if (x->rows == 0) return true;
+
+    U8 rows[4] = { (U8)x->rows, (U8)(x->rows >> 8), (U8)(x->rows >> 16), (U8)(x->rows >> 24) };
+    bool ok = fwrite(rows, sizeof(rows), 1, x->f) == 1;
+    for (unsigned i = 0; ok && i < x->column_count; ++i) {
+        ExtractColumn *c = &x->columns[i];
+        // Guest columns are big endian until now; the frame column is native.
+        if (c->type == FIELD_U16) swap16(c->data, x->rows);
+        else if (c->type == FIELD_U32 || c->type == FIELD_F32) swap32(c->data, x->rows);
+        ok = fwrite(c->data, (size_t)x->rows * c->width, 1, x->f) == 1;
+    }
+    x->rows = 0;
+    return ok;
+}
+
+// PLAN #########################################################################
+
+static int op_compare(const void *a, const void *b) {
+    const U8 *sa = ((const GatherOp *)a)->src;
+    const U8 *sb = ((const GatherOp *)b)->src;
+    return (sa > sb) - (sa < sb);
+}
+
+static bool add_column(Extractor *x, const char *name, FieldType type, U32 address, const FieldDef *def) {
+    ExtractColumn *c = &x->columns[x->column_count++];
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    c->type = type;
+    c->width = field_width(type);
+    c->data = malloc((size_t)EXTRACT_CHUNK_ROWS * c->width);
+    c->address = address;
+    if (def != NULL) {
+        c->derefs = def->derefs < FIELD_MAX_DEREFS ? def->derefs : FIELD_MAX_DEREFS;
+        memcpy(c->offsets, def->offsets, sizeof(c->offsets));
+    }
+    return c->data != NULL;
+}
+
+static bool build_plan(Extractor *x, const FieldDef *fields, size_t field_count) {
+    size_t capacity = 1;
+    for (size_t i = 0; i < field_count; ++i)
+        capacity += fields[i].port_stride ? INPUT_PORTS : 1;
+    x->columns = calloc(capacity, sizeof(ExtractColumn));
+    x->ops = calloc(capacity, sizeof(GatherOp));
+    x->chased = calloc(capacity, sizeof(U32));
+    if (x->columns == NULL || x->ops == NULL || x->chased == NULL) return false;
+
+    if (!add_column(x, "frame", FIELD_U64, 0, NULL)) return false;
+    for (size_t i = 0; i < field_count; ++i) {
+        const FieldDef *def = &fields[i];
+        unsigned ports = def->port_stride ? INPUT_PORTS : 1;
+        for (unsigned p = 0; p < ports; ++p) {
+            char name[32];
+            if (def->port_stride) snprintf(name, sizeof(name), "p%u_%s", p + 1, def->name);
+            else snprintf(name, sizeof(name), "%s", def->name);
+            U32 address = def->address + p * def->port_stride;
+            if (!add_column(x, name, def->type, address, def)) return false;
+
+            // Fixed fields are resolved to host memory once; the rest go
+            // through the memory map every frame.
+            U32 column = x->column_count - 1;
+            const ExtractColumn *c = &x->columns[column];
+            const U8 *src = c->derefs == 0 ? memmap_translate(x->memory, address, c->width) : NULL;
+            if (src != NULL) x->ops[x->op_count++] = (GatherOp) { src, column, c->width };
+            else x->chased[x->chased_count++] = column;
+        }
+    }
+    // Reading in address order keeps the gather walking forward through RAM.
+    qsort(x->ops, x->op_count, sizeof(GatherOp), op_compare);
+    return true;
+}
+
+bool extract_open(Extractor *x, const char *path, const MemoryMap *memory,
+    const FieldDef *fields, size_t field_count
+) {
+    memset(x, 0, sizeof(*x));
+    x->memory = memory;
+    swap_select();
+
+    if (!build_plan(x, fields, field_count)
+        || (x->f = fopen(path, "wb")) == NULL
+        || !write_header(x)
+    ) {
+        extract_close(x);
+        return false;
+    }
+    return true;
+}
+
+static void chase(const Extractor *x, const ExtractColumn *c, U8 *dst) {
+    U32 address = c->address;
+    for (unsigned i = 0; i < c->derefs; ++i) {
+        U32 pointer;
+        if (!memmap_read_u32(x->memory, address, &pointer) || pointer == 0) {
+            memset(dst, 0, c->width);
+            return;
+        }
+        address = pointer + c->offsets[i];
+    }
+    if (!memmap_read(x->memory, address, dst, c->width)) memset(dst, 0, c->width);
+}
+
+bool extract_frame(Extractor *x, U64 frame) {
+    if (x->f == NULL) return false;
+
+    unsigned row = x->rows;
+    memcpy(x->columns[0].data + (size_t)row * 8, &frame, 8);
+
+    for (unsigned i = 0; i < x->op_count; ++i) {
+        const GatherOp *op = &x->ops[i];
+        U8 *dst = x->columns[op->column].data + (size_t)row * op->width;
+        switch (op->width) {
+        case 1: *dst = *op->src; break;
+        case 2: memcpy(dst, op->src, 2); break;
+        default: memcpy(dst, op->src, 4); break;
+        }
+    }
+    for (unsigned i = 0; i < x->chased_count; ++i) {
+        const ExtractColumn *c = &x->columns[x->chased[i]];
+        chase(x, c, c->data + (size_t)row * c->width);
+    }
+
+    x->rows++;
+    x->total_rows++;
+    if (x->rows == EXTRACT_CHUNK_ROWS) return flush_chunk(x);
+    return true;
+}
+
+bool extract_close(Extractor *x) {
+    bool ok = true;
+    if (x->f != NULL) {
+        ok = flush_chunk(x);
+        ok = (fclose(x->f) == 0) && ok;
+    }
+    for (unsigned i = 0; x->columns != NULL && i < x->column_count; ++i)
+        free(x->columns[i].data);
+    free(x->columns);
+    free(x->ops);
+    free(x->chased);
+    U64 total = x->total_rows;
+    memset(x, 0, sizeof(*x));
+    x->total_rows = total;
+    return ok;
+}
@@ -0,0 +1,90 @@
+#ifndef EXTRACT_H
+#define EXTRACT_H
+
+#include "memmap.h"
+#include "types.h"
+
+#include <stdio.h>
+
+// Per-frame game state extraction into columns. A table of RAM fields is
+// compiled once into a gather plan: fields at fixed addresses become host
+// pointers sorted by address, fields behind pointers are chased through the
+// memory map every frame. Each frame appends one row to preallocated
+// struct-of-arrays columns still in guest byte order; when a chunk fills, every
+// column is byte-swapped in one vectorized pass and written out.
+//
+// File format, all little endian:
+//   "DECF", U16 version, U16 column count
+//   per column: U8 FieldType, U8 name length, name
+//   chunks until EOF: U32 rows, then each column's rows * width bytes
+// Column 0 is always the U64 frame number.
+
+#define EXTRACT_MAGIC "DECF"
+#define EXTRACT_VERSION 1
+#define EXTRACT_CHUNK_ROWS 8192
+#define FIELD_MAX_DEREFS 2
+
+typedef enum FieldType {
+    FIELD_U8,
+    FIELD_U16,
+    FIELD_U32,
+    FIELD_F32,
+    FIELD_U64,
+} FieldType;
+
+// A big-endian field at address. With derefs, the value at address is a
+// pointer, offsets[0] is added to it, and so on for each deref. A nonzero
+// port_stride makes one column per port with the address advanced by the
+// stride each port.
+typedef struct FieldDef {
+    const char *name;
+    U32 address;
+    U32 port_stride;
+    U8 derefs;
+    U32 offsets[FIELD_MAX_DEREFS];
+    FieldType type;
+} FieldDef;
+
+extern const FieldDef melee_fields[];
+extern const size_t melee_field_count;
+
+typedef struct ExtractColumn {
+    char name[32];
+    FieldType type;
+    unsigned width;
+    U8 *data;
+
+    U32 address;
+    U8 derefs;
+    U32 offsets[FIELD_MAX_DEREFS];
+} ExtractColumn;
+
+typedef struct GatherOp {
+    const U8 *src;
+    U32 column;
+    U32 width;
+} GatherOp;
+
+typedef struct Extractor {
+    const MemoryMap *memory;
+    FILE *f;
+    ExtractColumn *columns;
+    unsigned column_count;
+    GatherOp *ops;          // fixed fields
+    unsigned op_count;
+    U32 *chased;            // columns read through the memory map each frame
+    unsigned chased_count;
+    unsigned rows;
+    U64 total_rows;
+} Extractor;
+
+bool extract_open(Extractor *x, const char *path, const MemoryMap *memory,
+    const FieldDef *fields, size_t field_count);
+
+// Reads every field for this frame. Fields that can't be read are zero.
+bool extract_frame(Extractor *x, U64 frame);
+
+// Flushes the last chunk and closes the file.
+bool extract_close(Extractor *x);
+
+#endif
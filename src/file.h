@@ -0,0 +1,15 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include "types.h"
+
+typedef struct Bytes {
+    U8 *ptr;
+    U64 size;
+} Bytes;
+
+// Maps a whole file read-only. Returns { NULL, 0 } on failure with errno set.
+Bytes map_file(const char *path);
+void unmap_file(Bytes bytes);
+
+#endif
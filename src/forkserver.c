@@ -0,0 +1,239 @@
+// accept4
+#define _GNU_SOURCE
+#include "forkserver.h"
+#include "clock.h"
+#include "threads.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+typedef struct RequestHeader {
+    char magic[4];
+    U32 argc;
+    U32 size;
+    U32 cwd_size;
+    double client_start;
+} RequestHeader;
+
+typedef struct ExitTrailer {
+    char magic[4];
+    I32 status;
+} ExitTrailer;
+
+static volatile sig_atomic_t serving = 1;
+
+static void stop_serving(int signal) { (void)signal; serving = 0; }
+
+static bool unix_address(struct sockaddr_un *addr, const char *socket_path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr->sun_path)) return false;
+    strcpy(addr->sun_path, socket_path);
+    return true;
+}
+
+static bool read_all(int fd, void *dst, size_t size) {
+    U8 *p = dst;
+    while (size != 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void *src, size_t size) {
+    const U8 *p = src;
+    while (size != 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+bool forkserver_serve(const char *socket_path, int *conn) {
+    *conn = -1;
+    unsigned threads = thread_count();
+    if (threads > 1) {
+        fprintf(stderr, "the core has %u threads running, a forked job would only get one of them;"
+            " the fork-server needs a core that runs on the calling thread only\n", threads);
+        return false;
+    }
+    struct sockaddr_un addr;
+    if (!unix_address(&addr, socket_path)) {
+        fprintf(stderr, "socket path %s is too long\n", socket_path);
+        return false;
+    }
+    // Only a socket left behind by an earlier server is replaced.
+    struct stat existing;
+    if (lstat(socket_path, &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            fprintf(stderr, "%s exists and is not a socket\n", socket_path);
+            return false;
+        }
+        unlink(socket_path);
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0
+        || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(listener, 64) != 0
+    ) {
+        fprintf(stderr, "could not listen on %s: %s\n", socket_path, strerror(errno));
+        if (listener >= 0) close(listener);
+        return false;
+    }
+
+    // Without SA_RESTART so a signal gets the server out of accept. Children
+    // are reaped by the kernel.
+    struct sigaction stop = { .sa_handler = stop_serving };
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+    struct sigaction reap = { .sa_handler = SIG_IGN, .sa_flags = SA_NOCLDWAIT };
+    sigaction(SIGCHLD, &reap, NULL);
+
+    while (serving) {
+        int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            fprintf(stderr, "could not accept on %s: %s\n", socket_path, strerror(errno));
+            break;
+        }
+        // Output buffered before the fork would be written again by the child.
+        fflush(NULL);
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listener);
+            struct sigaction restore = { .sa_handler = SIG_DFL };
+            sigaction(SIGINT, &restore, NULL);
+            sigaction(SIGTERM, &restore, NULL);
+            sigaction(SIGCHLD, &restore, NULL);
+            *conn = fd;
+            return true;
+        }
+        if (pid < 0) fprintf(stderr, "could not fork: %s\n", strerror(errno));
+        close(fd);
+    }
+    close(listener);
+    unlink(socket_path);
+    return true;
+}
+
+bool forkserver_read_request(int fd, ForkRequest *request) {
+    static char program[] = "fork-server";
+    RequestHeader header;
+    if (!read_all(fd, &header, sizeof(header))
+        || memcmp(header.magic, FORKSERVER_MAGIC, 4) != 0
+        || header.argc > FORKSERVER_MAX_ARGS
+        || header.size > FORKSERVER_MAX_ARG_BYTES
+        || header.cwd_size == 0
+        || header.cwd_size > sizeof(request->cwd)
+        || !read_all(fd, request->cwd, header.cwd_size)
+        || request->cwd[header.cwd_size - 1] != 0
+        || !read_all(fd, request->args, header.size)
+    ) return false;
+
+    request->client_start = header.client_start;
+    request->argc = 1;
+    request->argv[0] = program;
+    for (size_t offset = 0; offset < header.size; ) {
+        char *arg = &request->args[offset];
+        size_t len = strnlen(arg, header.size - offset);
+        if (offset + len == header.size || request->argc > (int)header.argc) return false;
+        request->argv[request->argc++] = arg;
+        offset += len + 1;
+    }
+    request->argv[request->argc] = NULL;
+    return request->argc == (int)header.argc + 1;
+}
+
+void forkserver_send_status(int fd, int status) {
+    ExitTrailer trailer = { .status = status };
+    memcpy(trailer.magic, FORKSERVER_EXIT_MAGIC, 4);
+    write_all(fd, &trailer, sizeof(trailer));
+}
+
+int forkserver_client(const char *socket_path, int argc, char **argv) {
+    RequestHeader header = {
+        .argc = (U32)argc,
+        .client_start = time_now(),
+    };
+    memcpy(header.magic, FORKSERVER_MAGIC, 4);
+
+    char args[FORKSERVER_MAX_ARG_BYTES];
+    size_t size = 0;
+    for (int i = 0; i < argc; ++i) {
+        size_t len = strlen(argv[i]) + 1;
+        if (argc > FORKSERVER_MAX_ARGS || size + len > sizeof(args)) {
+            fprintf(stderr, "too many arguments for the fork-server\n");
+            return 1;
+        }
+        memcpy(args + size, argv[i], len);
+        size += len;
+    }
+    header.size = (U32)size;
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        fprintf(stderr, "could not get the working directory: %s\n", strerror(errno));
+        return 1;
+    }
+    header.cwd_size = (U32)strlen(cwd) + 1;
+
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0
+        || !unix_address(&addr, socket_path)
+        || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+    ) {
+        fprintf(stderr, "could not connect to %s: %s\n", socket_path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    if (!write_all(fd, &header, sizeof(header))
+        || !write_all(fd, cwd, header.cwd_size)
+        || !write_all(fd, args, size)
+    ) {
+        fprintf(stderr, "could not send the request to %s\n", socket_path);
+        close(fd);
+        return 1;
+    }
+    shutdown(fd, SHUT_WR);
+
+    // The exit status trails the output, so the last sizeof(ExitTrailer)
+    // bytes read are held back until the connection closes.
+    U8 buffer[4096 + sizeof(ExitTrailer)];
+    size_t held = 0;
+    while (true) {
+        ssize_t n = read(fd, buffer + held, sizeof(buffer) - held);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        held += (size_t)n;
+        if (held > sizeof(ExitTrailer)) {
+            size_t out = held - sizeof(ExitTrailer);
+            if (!write_all(STDOUT_FILENO, buffer, out)) break;
+            memmove(buffer, buffer + out, sizeof(ExitTrailer));
+            held = sizeof(ExitTrailer);
+        }
+    }
+    close(fd);
+
+    ExitTrailer trailer = { 0 };
+    if (held == sizeof(trailer)) memcpy(&trailer, buffer, sizeof(trailer));
+    if (memcmp(trailer.magic, FORKSERVER_EXIT_MAGIC, 4) != 0) {
+        write_all(STDOUT_FILENO, buffer, held);
+        fprintf(stderr, "the job ended without an exit status\n");
+        return 1;
+    }
+    return trailer.status;
+}
@@ -0,0 +1,58 @@
+#ifndef FORKSERVER_H
+#define FORKSERVER_H
+
+#include "types.h"
+
+#include <limits.h>
+
+// Fork-server: one process loads the core, boots the game and then forks a
+// child per request on a Unix socket, so every job starts from an emulator
+// that is already running instead of paying for the boot itself. A request
+// carries the job's command line, which the child parses like main's own; the
+// child's output goes back over the connection, followed by "DEFX" and the
+// job's I32 exit status once it exits.
+//
+// Forking only carries over the calling thread, so the core must not have
+// threads of its own running when the server forks; the server refuses to
+// start if it does. That includes libdolphin, which starts its CPU and GPU
+// threads while loading the game and isn't asked for single-threaded options,
+// so the server saves no boot time there: it serves cores that do all their
+// work inside retro_run.
+//
+// Request: "DEFS", U32 arg count, U32 arg bytes, U32 cwd bytes, F64 client
+// start time, then the client's working directory and the args, each NUL
+// terminated. The child changes to that directory so relative paths in the
+// args mean what they meant to the client. The start time is the client's
+// time_now(); CLOCK_MONOTONIC is the same clock in every process, so the child
+// can time the job from when the client started.
+
+#define FORKSERVER_MAGIC "DEFS"
+#define FORKSERVER_EXIT_MAGIC "DEFX"
+#define FORKSERVER_MAX_ARGS 64
+#define FORKSERVER_MAX_ARG_BYTES 8192
+
+typedef struct ForkRequest {
+    double client_start;
+    char cwd[PATH_MAX];
+    int argc;
+    char *argv[FORKSERVER_MAX_ARGS + 2]; // argv[0] is a placeholder, NULL terminated
+    char args[FORKSERVER_MAX_ARG_BYTES];
+} ForkRequest;
+
+// Listens on socket_path and forks for every connection until SIGINT or
+// SIGTERM. Returns in the child with the connection in *conn, and in the
+// server once it stops with *conn set to -1. Returns false if the process has
+// more than one thread or the socket couldn't be set up, after printing why.
+bool forkserver_serve(const char *socket_path, int *conn);
+
+bool forkserver_read_request(int fd, ForkRequest *request);
+
+// Ends the job's output on fd with its exit status. Flush stdio first.
+void forkserver_send_status(int fd, int status);
+
+// Sends argv to the server at socket_path and copies the job's output to
+// stdout until the job exits. Returns the job's exit status, or 1 if the
+// server couldn't be reached or the job ended without one, after printing why.
+int forkserver_client(const char *socket_path, int argc, char **argv);
+
+#endif
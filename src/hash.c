@@ -0,0 +1,179 @@
+#include "hash.h"
+#include "simd.h"
+
+#include <string.h>
+
+// Modeled on XXH3's long-input loop: eight 64-bit accumulators, each stripe of
+// 64 bytes is keyed, multiplied 32x32->64 and added, and the accumulators are
+// scrambled every HASH_BLOCK bytes so that no input bit stays in one lane.
+// As in XXH3, the key slides 8 bytes along the secret from one stripe of a
+// block to the next, so moving stripes around inside a block changes the hash.
+
+#define HASH_LANES 8
+#define HASH_STRIPE 64
+#define HASH_BLOCK 1024
+#define HASH_BLOCK_STRIPES (HASH_BLOCK / HASH_STRIPE)
+// One key offset per stripe of a block, then the scramble key.
+#define HASH_SECRET_SIZE (HASH_BLOCK_STRIPES + HASH_LANES)
+
+#define PRIME32_1 0x9E3779B1u
+#define PRIME64_1 UINT64_C(0x9E3779B185EBCA87)
+#define PRIME64_2 UINT64_C(0xC2B2AE3D27D4EB4F)
+#define PRIME64_3 UINT64_C(0x165667B19E3779F9)
+
+// XXH3's default secret.
+static const U64 hash_secret[HASH_SECRET_SIZE] = {
+    UINT64_C(0xbe4ba423396cfeb8), UINT64_C(0x1cad21f72c81017c),
+    UINT64_C(0xdb979083e96dd4de), UINT64_C(0x1f67b3b7a4a44072),
+    UINT64_C(0x78e5c0cc4ee679cb), UINT64_C(0x2172ffcc7dd05a82),
+    UINT64_C(0x8e2443f7744608b8), UINT64_C(0x4c263a81e69035e0),
+    UINT64_C(0xcb00c391bb52283c), UINT64_C(0xa32e531b8b65d088),
+    UINT64_C(0x4ef90da297486471), UINT64_C(0xd8acdea946ef1938),
+    UINT64_C(0x3f349ce33f76faa8), UINT64_C(0x1d4f0bc7c7bbdcf9),
+    UINT64_C(0x3159b4cd4be0518a), UINT64_C(0x647378d9c97e9fc8),
+    UINT64_C(0xc3ebd33483acc5ea), UINT64_C(0xeb6313faffa081c5),
+    UINT64_C(0x49daf0b751dd0d17), UINT64_C(0x9e68d429265516d3),
+    UINT64_C(0xfca1477d58be162b), UINT64_C(0xce31d07ad1b8f88f),
+    UINT64_C(0x280416958f3acb45), UINT64_C(0x7e404bbbcafbd7af),
+};
+
+static inline U64 read64(const U8 *p) {
+    U64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline U64 mul128_fold64(U64 a, U64 b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (U64)r ^ (U64)(r >> 64);
+}
+
+// key is the secret offset for the stripe's position in its block.
+static inline void accumulate_stripe(U64 *acc, const U8 *p, const U64 *key) {
+    for (unsigned i = 0; i < HASH_LANES; ++i) {
+        U64 d = read64(p + 8*i);
+        U64 k = d ^ key[i];
+        acc[i ^ 1] += d;
+        acc[i] += (k & 0xFFFFFFFFu) * (k >> 32);
+    }
+}
+
+static inline void scramble(U64 *acc, const U64 *key) {
+    for (unsigned i = 0; i < HASH_LANES; ++i) {
+        U64 a = acc[i];
+        a ^= a >> 47;
+        a ^= key[i];
+        acc[i] = a * PRIME32_1;
+    }
+}
+
+static void accumulate_scalar(U64 *acc, const U8 *p, size_t stripes, const U64 *secret) {
+    for (size_t s = 0; s < stripes; ++s) {
+        size_t n = s % HASH_BLOCK_STRIPES;
+        accumulate_stripe(acc, p + s * HASH_STRIPE, secret + n);
+        if (n == HASH_BLOCK_STRIPES - 1) scramble(acc, secret + HASH_BLOCK_STRIPES);
+    }
+}
+
+#if HAVE_X86
+
+AVX2 static void accumulate_avx2(U64 *acc, const U8 *p, size_t stripes, const U64 *secret) {
+    __m256i a0 = _mm256_loadu_si256((const __m256i*)acc);
+    __m256i a1 = _mm256_loadu_si256((const __m256i*)(acc + 4));
+    const __m256i sk0 = _mm256_loadu_si256((const __m256i*)(secret + HASH_BLOCK_STRIPES));
+    const __m256i sk1 = _mm256_loadu_si256((const __m256i*)(secret + HASH_BLOCK_STRIPES + 4));
+    const __m256i prime = _mm256_set1_epi32((int)PRIME32_1);
+
+    for (size_t s = 0; s < stripes; ++s) {
+        size_t n = s % HASH_BLOCK_STRIPES;
+        const U8 *stripe = p + s * HASH_STRIPE;
+        __m256i k0 = _mm256_loadu_si256((const __m256i*)(secret + n));
+        __m256i k1 = _mm256_loadu_si256((const __m256i*)(secret + n + 4));
+        __m256i d0 = _mm256_loadu_si256((const __m256i*)stripe);
+        __m256i d1 = _mm256_loadu_si256((const __m256i*)(stripe + 32));
+        __m256i x0 = _mm256_xor_si256(d0, k0);
+        __m256i x1 = _mm256_xor_si256(d1, k1);
+        // lo32 * hi32 of every keyed lane, plus the neighbouring lane's data.
+        __m256i m0 = _mm256_mul_epu32(x0, _mm256_srli_epi64(x0, 32));
+        __m256i m1 = _mm256_mul_epu32(x1, _mm256_srli_epi64(x1, 32));
+        __m256i s0 = _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2));
+        __m256i s1 = _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2));
+        a0 = _mm256_add_epi64(a0, _mm256_add_epi64(m0, s0));
+        a1 = _mm256_add_epi64(a1, _mm256_add_epi64(m1, s1));
+
+        if (n == HASH_BLOCK_STRIPES - 1) {
+            a0 = _mm256_xor_si256(_mm256_xor_si256(a0, _mm256_srli_epi64(a0, 47)), sk0);
+            a1 = _mm256_xor_si256(_mm256_xor_si256(a1, _mm256_srli_epi64(a1, 47)), sk1);
+            // 64x32 multiply: lo*p + (hi*p << 32)
+            __m256i lo0 = _mm256_mul_epu32(a0, prime);
+            __m256i hi0 = _mm256_mul_epu32(_mm256_srli_epi64(a0, 32), prime);
+            __m256i lo1 = _mm256_mul_epu32(a1, prime);
+            __m256i hi1 = _mm256_mul_epu32(_mm256_srli_epi64(a1, 32), prime);
+            a0 = _mm256_add_epi64(lo0, _mm256_slli_epi64(hi0, 32));
+            a1 = _mm256_add_epi64(lo1, _mm256_slli_epi64(hi1, 32));
+        }
+    }
+
+    _mm256_storeu_si256((__m256i*)acc, a0);
+    _mm256_storeu_si256((__m256i*)(acc + 4), a1);
+}
+
+#endif
+
+typedef void (*AccumulateFn)(U64 *acc, const U8 *p, size_t stripes, const U64 *secret);
+
+static AccumulateFn accumulate_select(void) {
+#if HAVE_X86
+    if (__builtin_cpu_supports("avx2")) return accumulate_avx2;
+#endif
+    return accumulate_scalar;
+}
+
+static U64 avalanche(U64 h) {
+    h ^= h >> 37;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+U64 hash_bytes(const void *data, size_t size, U64 seed) {
+    static AccumulateFn accumulate = NULL;
+    if (accumulate == NULL) accumulate = accumulate_select();
+
+    U64 secret[HASH_SECRET_SIZE];
+    for (unsigned i = 0; i < HASH_SECRET_SIZE; ++i)
+        secret[i] = hash_secret[i] + (i & 1 ? -seed : seed);
+
+    U64 acc[HASH_LANES] = {
+        PRIME32_1, PRIME64_1, PRIME64_2, PRIME64_3,
+        PRIME64_1 ^ seed, PRIME64_2 ^ seed, PRIME64_3 ^ seed, PRIME32_1 ^ seed,
+    };
+
+    const U8 *p = data;
+    size_t stripes = size / HASH_STRIPE;
+    accumulate(acc, p, stripes, secret);
+
+    // The tail goes through the same stripe step, zero padded and keyed for
+    // the position it would have in its block.
+    size_t tail = size % HASH_STRIPE;
+    if (tail != 0) {
+        U8 last[HASH_STRIPE] = { 0 };
+        memcpy(last, p + stripes * HASH_STRIPE, tail);
+        accumulate_stripe(acc, last, secret + stripes % HASH_BLOCK_STRIPES);
+    }
+
+    U64 h = (U64)size * PRIME64_1;
+    for (unsigned i = 0; i < HASH_LANES; i += 2)
+        h += mul128_fold64(acc[i] ^ secret[i], acc[i+1] ^ secret[i+1]);
+    return avalanche(h);
+}
+
+U64 hash_rows(const void *data, size_t row_size, size_t pitch, unsigned rows, U64 seed) {
+    if (row_size == pitch) return hash_bytes(data, row_size * rows, seed);
+
+    U64 h = seed;
+    const U8 *p = data;
+    for (unsigned y = 0; y < rows; ++y)
+        h = hash_bytes(p + (size_t)y * pitch, row_size, h);
+    return h;
+}
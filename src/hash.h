@@ -0,0 +1,13 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include "types.h"
+
+// Fast non-cryptographic 64-bit hash. The AVX2 and scalar paths produce
+// identical results, so hashes can be stored and compared across machines.
+U64 hash_bytes(const void *data, size_t size, U64 seed);
+
+// Hashes a 2D image row by row, skipping the padding between rows.
+U64 hash_rows(const void *data, size_t row_size, size_t pitch, unsigned rows, U64 seed);
+
+#endif
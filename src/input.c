@@ -0,0 +1,52 @@
+#include "input.h"
+
+#include <stdatomic.h>
+
+// Triple buffer: the producer owns back, the consumer owns front, and middle
+// is swapped between them. INPUT_FRESH marks a middle slot the consumer has
+// not taken yet.
+#define INPUT_FRESH 4u
+
+static InputSnapshot slots[3] = { 0 };
+static _Atomic U32 middle = 1;
+static U32 back = 0;
+static U32 front = 2;
+
+void input_publish(const InputSnapshot *snapshot) {
+    slots[back] = *snapshot;
+    U32 prev = atomic_exchange_explicit(&middle, back | INPUT_FRESH, memory_order_acq_rel);
+    back = prev & 3u;
+}
+
+const InputSnapshot *input_current(void) {
+    return &slots[front];
+}
+
+void RETRO_CALLCONV input_poll(void) {
+    if (atomic_load_explicit(&middle, memory_order_relaxed) & INPUT_FRESH) {
+        U32 prev = atomic_exchange_explicit(&middle, front, memory_order_acq_rel);
+        front = prev & 3u;
+    }
+}
+
+int16_t RETRO_CALLCONV input_state(unsigned port, unsigned device, unsigned index, unsigned id) {
+    if (port >= INPUT_PORTS) return 0;
+    const InputPort *p = &slots[front].ports[port];
+
+    switch (device) {
+    case RETRO_DEVICE_JOYPAD:
+        if (id == RETRO_DEVICE_ID_JOYPAD_MASK) return (int16_t)p->buttons;
+        return id < 16 ? (int16_t)((p->buttons >> id) & 1u) : 0;
+    case RETRO_DEVICE_ANALOG:
+        if (index == RETRO_DEVICE_INDEX_ANALOG_BUTTON) {
+            if (id == RETRO_DEVICE_ID_JOYPAD_L2) return p->triggers[0];
+            if (id == RETRO_DEVICE_ID_JOYPAD_R2) return p->triggers[1];
+            return id < 16 && ((p->buttons >> id) & 1u) ? 0x7FFF : 0;
+        }
+        if (index <= RETRO_DEVICE_INDEX_ANALOG_RIGHT && id <= RETRO_DEVICE_ID_ANALOG_Y)
+            return p->axes[index * 2 + id];
+        return 0;
+    default:
+        return 0;
+    }
+}
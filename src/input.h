@@ -0,0 +1,33 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "libretro.h"
+#include "types.h"
+
+// Controller state for the four GameCube ports is published as immutable
+// snapshots through a lock-free triple buffer. Any one thread may publish;
+// the emulation thread picks up the newest snapshot in retro_input_poll and
+// answers every retro_input_state query for that frame from it.
+
+#define INPUT_PORTS 4
+
+typedef struct InputPort {
+    U16 buttons;     // bit n = RETRO_DEVICE_ID_JOYPAD_n
+    I16 axes[4];     // left x, left y, right x, right y
+    I16 triggers[2]; // analog L2, R2
+} InputPort;
+
+typedef struct InputSnapshot {
+    InputPort ports[INPUT_PORTS];
+} InputSnapshot;
+
+// Producer side.
+void input_publish(const InputSnapshot *snapshot);
+
+// The snapshot the core saw at its last poll.
+const InputSnapshot *input_current(void);
+
+void RETRO_CALLCONV input_poll(void);
+int16_t RETRO_CALLCONV input_state(unsigned port, unsigned device, unsigned index, unsigned id);
+
+#endif
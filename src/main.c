@@ -1,113 +1,417 @@
 #include "libretro.h"
+#include "types.h"
+#include "core.h"
+#include "convert.h"
+#include "clock.h"
+#include "hash.h"
+#include "audio.h"
+#include "input.h"
+#include "file.h"
+#include "movie.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "rollback.h"
+#include "channel.h"
+#include "memmap.h"
+#include "extract.h"
+#include "ramwatch.h"
+#include "savestate.h"
+#include "forkserver.h"
 
 #include <raylib.h>
 
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdint.h>
 #include <stdarg.h>
 #include <signal.h>
-
-typedef uint64_t U64;
-typedef int64_t I64;
-typedef uint8_t U8;
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
 // #define CTX RETRO_HW_CONTEXT_VULKAN
 #define CTX RETRO_HW_CONTEXT_VULKAN
 
+#define REWIND_KEYFRAME_EVERY 30
+#define GC_MEM1_START 0x80000000u
+
 // GLOBALS ######################################################################
 
 enum retro_pixel_format video_format = RETRO_PIXEL_FORMAT_UNKNOWN;
 
-// CORE LOADING #################################################################
-// taken from https://github.com/davidgfnet/miniretro
-
-#ifdef WIN32
-  #include <windows.h>
-  #define LIBHANDLE HMODULE
-  #define LOAD_LIBRARY(path) LoadLibraryA(path)
-  #define UNLOAD_LIBRARY(lib) FreeLibrary(lib)
-  #define LOAD_SYMBOL(lib, name) GetProcAddress(lib, name)
-#else
-  #include <dlfcn.h>
-  #define LIBHANDLE void*
-  #define LOAD_LIBRARY(path) dlopen(path, RTLD_LAZY | RTLD_LOCAL)
-  #define UNLOAD_LIBRARY(lib) dlclose(lib)
-  #define LOAD_SYMBOL(lib, name) dlsym(lib, name)
-#endif
-
-typedef RETRO_CALLCONV void (*core_info_fnt)(struct retro_system_info *info);
-typedef RETRO_CALLCONV void (*core_action_fnt)(void);
-typedef RETRO_CALLCONV bool (*core_loadg_fnt)(const struct retro_game_info *game);
-typedef RETRO_CALLCONV void (*core_unloadg_fnt)(void);
-typedef RETRO_CALLCONV void (*core_set_environment_fnt)(retro_environment_t);
-typedef RETRO_CALLCONV void (*core_set_video_refresh_fnt)(retro_video_refresh_t);
-typedef RETRO_CALLCONV void (*core_set_audio_sample_fnt)(retro_audio_sample_t);
-typedef RETRO_CALLCONV void (*core_set_audio_sample_batch_fnt)(retro_audio_sample_batch_t);
-typedef RETRO_CALLCONV void (*core_set_input_poll_fnt)(retro_input_poll_t);
-typedef RETRO_CALLCONV void (*core_set_input_state_fnt)(retro_input_state_t);
-typedef RETRO_CALLCONV bool (*core_serialize_fnt)(void *data, size_t size);
-typedef RETRO_CALLCONV size_t (*core_serialize_size_fnt)(void);
-typedef RETRO_CALLCONV bool (*core_unserialize_fnt)(const void *data, size_t size);
-typedef RETRO_CALLCONV void (*core_get_system_av_info_fnt)(struct retro_system_av_info *info);
-
-typedef struct {
-    core_action_fnt core_init;
-    core_action_fnt core_deinit;
-    core_action_fnt core_run;
-    core_action_fnt core_reset;
-    core_info_fnt   core_get_info;
-    core_loadg_fnt  core_load_game;
-    core_unloadg_fnt core_unload_game;
-    core_set_environment_fnt core_set_env_function;
-    core_set_video_refresh_fnt core_set_video_refresh_function;
-    core_set_audio_sample_fnt core_set_audio_sample_function;
-    core_set_audio_sample_batch_fnt core_set_audio_sample_batch_function;
-    core_set_input_poll_fnt core_set_input_poll_function;
-    core_set_input_state_fnt core_set_input_state_function;
-    core_serialize_fnt core_serialize;
-    core_serialize_size_fnt core_serialize_size;
-    core_unserialize_fnt core_unserialize;
-    core_get_system_av_info_fnt core_get_system_av_info;
-
-    LIBHANDLE handle;
-} core_functions_t;
-
-core_functions_t *load_core(const char *filename) {
-    LIBHANDLE libhandle = LOAD_LIBRARY(filename);
-    if (!libhandle)
-        return NULL;
-
-    core_functions_t *fns = malloc(sizeof(core_functions_t));
-    
-    fns->core_init                            = (core_action_fnt)                 LOAD_SYMBOL(libhandle, "retro_init");
-    fns->core_deinit                          = (core_action_fnt)                 LOAD_SYMBOL(libhandle, "retro_deinit");
-    fns->core_run                             = (core_action_fnt)                 LOAD_SYMBOL(libhandle, "retro_run");
-    fns->core_reset                           = (core_action_fnt)                 LOAD_SYMBOL(libhandle, "retro_reset");
-    fns->core_get_info                        = (core_info_fnt)                   LOAD_SYMBOL(libhandle, "retro_get_system_info");
-    fns->core_load_game                       = (core_loadg_fnt)                  LOAD_SYMBOL(libhandle, "retro_load_game");
-    fns->core_unload_game                     = (core_unloadg_fnt)                LOAD_SYMBOL(libhandle, "retro_unload_game");
-
-    fns->core_set_env_function                = (core_set_environment_fnt)        LOAD_SYMBOL(libhandle, "retro_set_environment");
-    fns->core_set_video_refresh_function      = (core_set_video_refresh_fnt)      LOAD_SYMBOL(libhandle, "retro_set_video_refresh");
-    fns->core_set_audio_sample_function       = (core_set_audio_sample_fnt)       LOAD_SYMBOL(libhandle, "retro_set_audio_sample");
-    fns->core_set_audio_sample_batch_function = (core_set_audio_sample_batch_fnt) LOAD_SYMBOL(libhandle, "retro_set_audio_sample_batch");
-    fns->core_set_input_poll_function         = (core_set_input_poll_fnt)         LOAD_SYMBOL(libhandle, "retro_set_input_poll");
-    fns->core_set_input_state_function        = (core_set_input_state_fnt)        LOAD_SYMBOL(libhandle, "retro_set_input_state");
-
-    fns->core_serialize                       = (core_serialize_fnt)              LOAD_SYMBOL(libhandle, "retro_serialize");
-    fns->core_serialize_size                  = (core_serialize_size_fnt)         LOAD_SYMBOL(libhandle, "retro_serialize_size");
-    fns->core_unserialize                     = (core_unserialize_fnt)            LOAD_SYMBOL(libhandle, "retro_unserialize");
-    fns->core_get_system_av_info              = (core_get_system_av_info_fnt)     LOAD_SYMBOL(libhandle, "retro_get_system_av_info");
-    fns->handle = libhandle;
-
-    return fns;
+// headless runs never touch raylib: no window, no vsync, core_run free-runs.
+bool headless = false;
+
+// What RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE reports. Cleared entirely when
+// headless, and switched per frame by run-ahead; the audio and video callbacks
+// drop whatever is disabled.
+int av_enable = RETRO_AV_ENABLE_VIDEO | RETRO_AV_ENABLE_AUDIO;
+volatile sig_atomic_t quit_requested = 0;
+
+// When the run started, for the boot-to-first-frame time: entering main, or
+// for a fork-server job, when its client sent the request.
+double boot_start = 0.0;
+
+// Guest memory as described by the core's RETRO_ENVIRONMENT_SET_MEMORY_MAPS.
+MemoryMap memory = { 0 };
+
+// Shared-memory observation channel for an external consumer, see channel.h.
+// Frames are written from video_update and published after each core_run.
+Channel observe = { .fd = -1 };
+bool observing = false;
+
+// SOFTWARE FRAMEBUFFER #########################################################
+
+// Host-owned buffer handed to the core through
+// RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER, so the core renders
+// straight into memory we own and video_update never has to copy the frame.
+// Rows are padded to a cache line, and pitches that are a multiple of the page
+// size get one extra line so consecutive rows don't alias the same cache sets.
+
+#define FRAMEBUFFER_ALIGN 4096
+#define FRAMEBUFFER_ROW_ALIGN 64
+
+typedef struct Framebuffer {
+    U8 *ptr;
+    U64 size;
+    unsigned width;
+    unsigned height;
+    size_t pitch;
+    enum retro_pixel_format format;
+} Framebuffer;
+
+Framebuffer framebuffer = { 0 };
+
+unsigned pixel_format_size(enum retro_pixel_format format) {
+    return format == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+}
+
+bool framebuffer_get(struct retro_framebuffer *fb) {
+    if (fb == NULL || fb->width == 0 || fb->height == 0) return false;
+
+    // libretro defaults to 0RGB1555 until the core sets a format.
+    enum retro_pixel_format format = video_format == RETRO_PIXEL_FORMAT_UNKNOWN
+        ? RETRO_PIXEL_FORMAT_0RGB1555 : video_format;
+
+    if (framebuffer.ptr == NULL
+        || framebuffer.width != fb->width
+        || framebuffer.height != fb->height
+        || framebuffer.format != format
+    ) {
+        size_t pitch = (size_t)fb->width * pixel_format_size(format);
+        pitch = (pitch + FRAMEBUFFER_ROW_ALIGN - 1) & ~(size_t)(FRAMEBUFFER_ROW_ALIGN - 1);
+        if (pitch % FRAMEBUFFER_ALIGN == 0) pitch += FRAMEBUFFER_ROW_ALIGN;
+
+        U64 size = (U64)pitch * fb->height;
+        size = (size + FRAMEBUFFER_ALIGN - 1) & ~(U64)(FRAMEBUFFER_ALIGN - 1);
+
+        if (size > framebuffer.size) {
+            free(framebuffer.ptr);
+            framebuffer.ptr = aligned_alloc(FRAMEBUFFER_ALIGN, size);
+            if (framebuffer.ptr == NULL) {
+                framebuffer = (Framebuffer) { 0 };
+                return false;
+            }
+            framebuffer.size = size;
+        }
+        framebuffer.width = fb->width;
+        framebuffer.height = fb->height;
+        framebuffer.pitch = pitch;
+        framebuffer.format = format;
+    }
+
+    fb->data = framebuffer.ptr;
+    fb->pitch = framebuffer.pitch;
+    fb->format = framebuffer.format;
+    fb->memory_flags = RETRO_MEMORY_TYPE_CACHED;
+    return true;
+}
+
+// VIDEO ########################################################################
+
+// Frames are streamed into persistent textures sized from the core's maximum
+// geometry, so a texture is only recreated when the core changes geometry
+// (retro_get_system_av_info, SET_GEOMETRY, SET_SYSTEM_AV_INFO). Two textures
+// are used in turn, so frame N is written into a different texture than the
+// one frame N-1 was drawn from. The write is still a synchronous
+// UpdateTextureRec from the staging buffer; the rotation only keeps it off a
+// texture a pending draw may read, it doesn't overlap the upload with drawing.
+// None of the libretro pixel formats match a raylib texture format, so every
+// frame goes through the conversion kernel picked when the format is set.
+// Duplicate frames, either NULL (GET_CAN_DUPE) or byte-identical to the last
+// one, skip conversion and upload; video.dup tells later consumers the same.
+// The check runs headless too, so the observation channel skips them as well.
+
+#define VIDEO_TEXTURES 2
+
+typedef struct Video {
+    struct retro_game_geometry geometry;
+    bool geometry_dirty;
+    Texture2D textures[VIDEO_TEXTURES];
+    unsigned current;
+    unsigned width;
+    unsigned height;
+    ConvertFn convert;
+    U8 *staging;
+    U64 staging_size;
+
+    U64 hash;          // of the last distinct frame
+    unsigned hash_width;
+    unsigned hash_height;
+    bool dup;
+    U64 frames;
+    U64 dup_frames;
+} Video;
+
+Video video = { 0 };
+
+void video_set_geometry(const struct retro_game_geometry *geometry) {
+    bool resize = geometry->base_width != video.geometry.base_width
+        || geometry->base_height != video.geometry.base_height;
+    video.geometry = *geometry;
+    video.geometry_dirty = true;
+    if (resize && !headless && geometry->base_width && geometry->base_height)
+        SetWindowSize((int)geometry->base_width, (int)geometry->base_height);
+}
+
+void video_create_textures(unsigned width, unsigned height) {
+    for (unsigned i = 0; i < VIDEO_TEXTURES; ++i) {
+        if (video.textures[i].id != 0) UnloadTexture(video.textures[i]);
+        Image blank = GenImageColor((int)width, (int)height, BLACK);
+        video.textures[i] = LoadTextureFromImage(blank);
+        UnloadImage(blank);
+    }
+    video.current = 0;
+    video.width = 0;
+    video.height = 0;
+    video.geometry_dirty = false;
+}
+
+bool video_set_format(enum retro_pixel_format format) {
+    ConvertFn convert = convert_select(format);
+    if (convert == NULL) return false;
+    video_format = format;
+    video.convert = convert;
+    return true;
+}
+
+void video_upload(const void *data, unsigned width, unsigned height, size_t pitch) {
+    unsigned max_width = video.geometry.max_width > width ? video.geometry.max_width : width;
+    unsigned max_height = video.geometry.max_height > height ? video.geometry.max_height : height;
+
+    Texture2D *tex = &video.textures[video.current];
+    if (video.geometry_dirty
+        || tex->id == 0
+        || (unsigned)tex->width < max_width
+        || (unsigned)tex->height < max_height
+    ) {
+        video_create_textures(max_width, max_height);
+    }
+
+    size_t staging_pitch = (size_t)width * 4;
+    U64 staging_size = (U64)staging_pitch * height;
+    if (staging_size > video.staging_size) {
+        free(video.staging);
+        video.staging = malloc(staging_size);
+        assert(video.staging != NULL);
+        video.staging_size = staging_size;
+    }
+
+    if (video.convert == NULL) video.convert = convert_select(video_format);
+    video.convert(video.staging, staging_pitch, data, pitch, width, height);
+
+    video.current = (video.current + 1) % VIDEO_TEXTURES;
+    Rectangle rec = { 0, 0, (float)width, (float)height };
+    UpdateTextureRec(video.textures[video.current], rec, video.staging);
+    video.width = width;
+    video.height = height;
 }
 
-void unload_core(core_functions_t *core) {
-    UNLOAD_LIBRARY(core->handle);
-    free(core);
+void video_present(void) {
+    BeginDrawing();
+    ClearBackground(WHITE);
+    if (video.width != 0) {
+        Rectangle src = { 0, 0, (float)video.width, (float)video.height };
+        int screen_width = GetScreenWidth();
+        int screen_height = GetScreenHeight();
+        Rectangle dst = { 0, 0, (float)screen_width, (float)screen_height };
+        DrawTexturePro(video.textures[video.current], src, dst, (Vector2) { 0, 0 }, 0.0f, WHITE);
+    }
+    EndDrawing();
+}
+
+void RETRO_CALLCONV video_update(const void *data, unsigned width, unsigned height, size_t pitch) {
+    if (!(av_enable & RETRO_AV_ENABLE_VIDEO)) return;
+
+    // When the core rendered through GET_CURRENT_SOFTWARE_FRAMEBUFFER,
+    // data == framebuffer.ptr and the frame is read in place.
+    bool software = data != NULL && data != RETRO_HW_FRAME_BUFFER_VALID;
+    video.frames++;
+    video.dup = true;
+    if (software) {
+        size_t row_size = (size_t)width * pixel_format_size(video_format);
+        U64 hash = hash_rows(data, row_size, pitch, height, ((U64)width << 32) | height);
+        if (hash != video.hash || video.hash_width != width || video.hash_height != height) {
+            video.hash = hash;
+            video.hash_width = width;
+            video.hash_height = height;
+            video.dup = false;
+        }
+    }
+    if (video.dup) video.dup_frames++;
+
+    if (observing && software) {
+        if (video.convert == NULL) video.convert = convert_select(video_format);
+        channel_write_frame(&observe, data, width, height, pitch, video.convert, video.dup);
+    }
+    if (headless) return;
+
+    if (!video.dup) video_upload(data, width, height, pitch);
+    video_present();
+}
+
+// AUDIO ########################################################################
+
+// Core audio is pushed into the lock-free ring in audio.c from the emulation
+// thread; raylib's audio thread pulls it back out through the resampler at
+// AUDIO_OUTPUT_RATE, so neither side ever blocks on the other.
+//
+// Frame pacing comes from vsync, and rate control in the resampler absorbs the
+// difference between the display's refresh rate and the core's ~59.94 Hz by
+// keeping the ring near AUDIO_LATENCY. Only when the display runs much faster
+// than the core does the loop wait on the ring (audio_pace).
+
+#define AUDIO_OUTPUT_RATE 48000
+#define AUDIO_RING_FRAMES 8192
+#define AUDIO_LATENCY 0.064
+
+AudioStream audio_stream = { 0 };
+bool audio_running = false;
+size_t audio_target = 0;
+retro_audio_buffer_status_callback_t audio_status_callback = NULL;
+
+size_t RETRO_CALLCONV audio_sample_batch(const int16_t *data, size_t frames) {
+    if (!headless && (av_enable & RETRO_AV_ENABLE_AUDIO)) audio_push(data, frames);
+    return frames;
+}
+
+void RETRO_CALLCONV audio_sample(int16_t left, int16_t right) {
+    const I16 frame[2] = { left, right };
+    audio_sample_batch(frame, 1);
+}
+
+void audio_stream_callback(void *buffer, unsigned int frames) {
+    audio_pull(buffer, frames);
+}
+
+void audio_start(double sample_rate) {
+    if (headless || sample_rate <= 0.0) return;
+
+    InitAudioDevice();
+    if (!IsAudioDeviceReady()) return;
+
+    audio_target = (size_t)(sample_rate * AUDIO_LATENCY);
+    audio_init(sample_rate, AUDIO_OUTPUT_RATE, AUDIO_RING_FRAMES, audio_target);
+    audio_stream = LoadAudioStream(AUDIO_OUTPUT_RATE, 16, 2);
+    SetAudioStreamCallback(audio_stream, audio_stream_callback);
+    PlayAudioStream(audio_stream);
+    audio_running = true;
+}
+
+// Tells the core how full the ring is before each frame
+// (RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK).
+void audio_report_status(void) {
+    if (audio_status_callback == NULL) return;
+    if (!audio_running) {
+        audio_status_callback(false, 0, false);
+        return;
+    }
+    AudioStats stats = audio_stats();
+    size_t fill = audio_fill();
+    unsigned occupancy = (unsigned)(fill * 100 / stats.capacity);
+    audio_status_callback(true, occupancy, fill < audio_target / 4);
+}
+
+// Blocks while the ring holds more than twice the target latency, which only
+// happens when vsync is missing or faster than the core's frame rate.
+void audio_pace(void) {
+    if (audio_running) audio_wait(audio_target * 2, 0.1);
+}
+
+// INPUT ########################################################################
+
+// Gamepads (and the keyboard for port 0) are read through raylib on the main
+// thread between frames and published as one snapshot per frame; see input.c.
+
+typedef struct ButtonMapping {
+    int raylib;
+    unsigned retro;
+} ButtonMapping;
+
+const ButtonMapping gamepad_buttons[] = {
+    { GAMEPAD_BUTTON_RIGHT_FACE_DOWN,  RETRO_DEVICE_ID_JOYPAD_B },
+    { GAMEPAD_BUTTON_RIGHT_FACE_RIGHT, RETRO_DEVICE_ID_JOYPAD_A },
+    { GAMEPAD_BUTTON_RIGHT_FACE_LEFT,  RETRO_DEVICE_ID_JOYPAD_Y },
+    { GAMEPAD_BUTTON_RIGHT_FACE_UP,    RETRO_DEVICE_ID_JOYPAD_X },
+    { GAMEPAD_BUTTON_LEFT_FACE_UP,     RETRO_DEVICE_ID_JOYPAD_UP },
+    { GAMEPAD_BUTTON_LEFT_FACE_DOWN,   RETRO_DEVICE_ID_JOYPAD_DOWN },
+    { GAMEPAD_BUTTON_LEFT_FACE_LEFT,   RETRO_DEVICE_ID_JOYPAD_LEFT },
+    { GAMEPAD_BUTTON_LEFT_FACE_RIGHT,  RETRO_DEVICE_ID_JOYPAD_RIGHT },
+    { GAMEPAD_BUTTON_LEFT_TRIGGER_1,   RETRO_DEVICE_ID_JOYPAD_L },
+    { GAMEPAD_BUTTON_RIGHT_TRIGGER_1,  RETRO_DEVICE_ID_JOYPAD_R },
+    { GAMEPAD_BUTTON_LEFT_TRIGGER_2,   RETRO_DEVICE_ID_JOYPAD_L2 },
+    { GAMEPAD_BUTTON_RIGHT_TRIGGER_2,  RETRO_DEVICE_ID_JOYPAD_R2 },
+    { GAMEPAD_BUTTON_MIDDLE_LEFT,      RETRO_DEVICE_ID_JOYPAD_SELECT },
+    { GAMEPAD_BUTTON_MIDDLE_RIGHT,     RETRO_DEVICE_ID_JOYPAD_START },
+};
+
+const ButtonMapping keyboard_buttons[] = {
+    { KEY_X,     RETRO_DEVICE_ID_JOYPAD_A },
+    { KEY_Z,     RETRO_DEVICE_ID_JOYPAD_B },
+    { KEY_S,     RETRO_DEVICE_ID_JOYPAD_X },
+    { KEY_A,     RETRO_DEVICE_ID_JOYPAD_Y },
+    { KEY_Q,     RETRO_DEVICE_ID_JOYPAD_L },
+    { KEY_W,     RETRO_DEVICE_ID_JOYPAD_R },
+    { KEY_ENTER, RETRO_DEVICE_ID_JOYPAD_START },
+};
+
+I16 axis_to_i16(float v) {
+    if (v > 1.0f) v = 1.0f;
+    if (v < -1.0f) v = -1.0f;
+    return (I16)(v * 32767.0f);
+}
+
+void input_read_devices(InputSnapshot *snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+
+    for (int pad = 0; pad < INPUT_PORTS; ++pad) {
+        if (!IsGamepadAvailable(pad)) continue;
+        InputPort *port = &snapshot->ports[pad];
+
+        for (size_t i = 0; i < sizeof(gamepad_buttons) / sizeof(gamepad_buttons[0]); ++i) {
+            if (IsGamepadButtonDown(pad, gamepad_buttons[i].raylib))
+                port->buttons |= (U16)(1u << gamepad_buttons[i].retro);
+        }
+        port->axes[0] = axis_to_i16(GetGamepadAxisMovement(pad, GAMEPAD_AXIS_LEFT_X));
+        port->axes[1] = axis_to_i16(GetGamepadAxisMovement(pad, GAMEPAD_AXIS_LEFT_Y));
+        port->axes[2] = axis_to_i16(GetGamepadAxisMovement(pad, GAMEPAD_AXIS_RIGHT_X));
+        port->axes[3] = axis_to_i16(GetGamepadAxisMovement(pad, GAMEPAD_AXIS_RIGHT_Y));
+        // raylib reports triggers from -1 (released) to 1 (pressed).
+        port->triggers[0] = axis_to_i16((GetGamepadAxisMovement(pad, GAMEPAD_AXIS_LEFT_TRIGGER) + 1.0f) * 0.5f);
+        port->triggers[1] = axis_to_i16((GetGamepadAxisMovement(pad, GAMEPAD_AXIS_RIGHT_TRIGGER) + 1.0f) * 0.5f);
+    }
+
+    if (!IsGamepadAvailable(0)) {
+        InputPort *port = &snapshot->ports[0];
+        for (size_t i = 0; i < sizeof(keyboard_buttons) / sizeof(keyboard_buttons[0]); ++i) {
+            if (IsKeyDown(keyboard_buttons[i].raylib))
+                port->buttons |= (U16)(1u << keyboard_buttons[i].retro);
+        }
+        if (IsKeyDown(KEY_LEFT))  port->axes[0] = -32767;
+        if (IsKeyDown(KEY_RIGHT)) port->axes[0] = 32767;
+        if (IsKeyDown(KEY_UP))    port->axes[1] = -32767;
+        if (IsKeyDown(KEY_DOWN))  port->axes[1] = 32767;
+    }
 }
 
 void RETRO_CALLCONV logging_callback(enum retro_log_level level, const char *fmt, ...) {
@@ -122,10 +426,14 @@ bool RETRO_CALLCONV env_callback(unsigned cmd, void *data) {
     switch (cmd) {
     case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
         printf("env set format %u\n", *(enum retro_pixel_format*)data);
-        video_format = *(enum retro_pixel_format*)data;
-        return true;
+        return video_set_format(*(enum retro_pixel_format*)data);
     case RETRO_ENVIRONMENT_GET_VARIABLE:
         return false;
+    case RETRO_ENVIRONMENT_GET_INPUT_BITMASKS:
+        return true;
+    case RETRO_ENVIRONMENT_GET_CAN_DUPE:
+        *(bool*)data = true;
+        return true;
     case RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY:
         *((const char**)data) = "/home/alex/melee/tutor/emu_embed";
         return true;
@@ -137,7 +445,7 @@ bool RETRO_CALLCONV env_callback(unsigned cmd, void *data) {
     case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
         return false;
     case RETRO_ENVIRONMENT_SET_MEMORY_MAPS:
-        return true;
+        return memmap_set(&memory, data);
     case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
         ((struct retro_log_callback*)data)->log = &logging_callback;
         return true;
@@ -162,91 +470,654 @@ bool RETRO_CALLCONV env_callback(unsigned cmd, void *data) {
         return true;
     case RETRO_ENVIRONMENT_SET_HW_RENDER_CONTEXT_NEGOTIATION_INTERFACE:
         return false;
+    case RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER:
+        return framebuffer_get(data);
+    case RETRO_ENVIRONMENT_SET_GEOMETRY:
+        video_set_geometry(data);
+        return true;
+    case RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO:
+        video_set_geometry(&((const struct retro_system_av_info*)data)->geometry);
+        return true;
+    case RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK:
+        audio_status_callback = data != NULL
+            ? ((const struct retro_audio_buffer_status_callback*)data)->callback : NULL;
+        return true;
+    case RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE:
+        if (data != NULL)
+            *(int*)data = av_enable;
+        return true;
     default:
         printf("unhandled cmd %u\n", cmd);
         return false;
     }
 }
 
-void RETRO_CALLCONV video_update(const void *data, unsigned width, unsigned height, size_t pitch) {
-    printf("video update\n");
-    (void)pitch;
-
-    //if (data == NULL) return;
-    //Image image = {
-    //    .data = data,
-    //    .width = (int)width,
-    //    .height = (int)height,
-    //    .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
-    //    .mipmaps = 1
-    //};
-    //Texture2D tex = LoadTextureFromImage(image);
-
-    BeginDrawing();
-    ClearBackground(WHITE);
-    //DrawTexture(tex, 0, 0, WHITE);
-    EndDrawing();
+// The run-ahead instance shares the host's video, but its memory is always
+// frames ahead of the real game and its audio is never played, so it must not
+// replace the primary's memory map or audio buffer status callback.
+bool RETRO_CALLCONV secondary_env_callback(unsigned cmd, void *data) {
+    switch (cmd) {
+    case RETRO_ENVIRONMENT_SET_MEMORY_MAPS:
+        return true;
+    case RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK:
+        return false;
+    default:
+        return env_callback(cmd, data);
+    }
 }
 
 // main ###########################################################################
 
-typedef struct Bytes {
-    U8 *ptr;
-    U64 size;
-} Bytes;
-
-Bytes read_file(const char* path) {
-    FILE *f = fopen(path, "rb");
-    if (f == NULL) return (Bytes) { .ptr = NULL, .size = 0 };
-    fseek(f, 0, SEEK_END);
-    I64 ret = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    U64 fsize = (U64)ret;
-
-    U8* c = malloc(fsize + 1);
-    fread(c, fsize, 1, f);
-    fclose(f);
-
-    return (Bytes) {
-        .ptr = c,
-        .size = fsize,
-    };
-}
+// Set when a RAM watchpoint fires, see pause_wait.
+bool paused = false;
 
 void alarmhandler(int signal) { (void)signal; exit(1); }
+void quithandler(int signal) { (void)signal; quit_requested = 1; }
 
-int main(void) {
-    SetTraceLogLevel(LOG_WARNING);
-    InitWindow(640, 480, "dolphin");
-    SetTargetFPS(60);
-
-    core_functions_t *core = load_core("./libdolphin.so");
-    assert(core != NULL);
-
-    core->core_set_env_function(&env_callback);
+// Hooks the host callbacks up to a freshly loaded core, initializes it and
+// loads the game.
+bool start_core(core_functions_t *core, retro_environment_t env, const char *path, Bytes *iso) {
+    core->core_set_env_function(env);
     core->core_set_video_refresh_function(&video_update);
-    core->core_set_audio_sample_function(NULL);
-    core->core_set_audio_sample_batch_function(NULL);
-    core->core_set_input_poll_function(NULL);
-    core->core_set_input_state_function(NULL);
+    core->core_set_audio_sample_function(&audio_sample);
+    core->core_set_audio_sample_batch_function(&audio_sample_batch);
+    core->core_set_input_poll_function(&input_poll);
+    core->core_set_input_state_function(&input_state);
 
     core->core_init();
+    return load_game(core, path, iso);
+}
+
+// Holds the loop while a watchpoint has it paused. In a window, space resumes
+// and N runs a single frame before pausing again; headless runs resume on
+// enter. Returns false if the user quit instead.
+bool pause_wait(void) {
+    if (headless) {
+        printf("paused, press enter to continue\n");
+        fflush(stdout);
+        for (int c; (c = getchar()) != '\n';)
+            if (c == EOF) return false;
+        paused = false;
+        return !quit_requested;
+    }
+    while (!WindowShouldClose()) {
+        if (IsKeyPressed(KEY_SPACE)) {
+            paused = false;
+            return true;
+        }
+        if (IsKeyPressed(KEY_N)) return true;
+        video_present();
+    }
+    return false;
+}
 
-    const char *path = "/home/alex/melee/melee_vanilla.iso";
-    Bytes iso = read_file(path);
-    assert(iso.ptr);
+void usage(const char *argv0) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "       %s --fork-client SOCKET [options]  run on a fork-server, options as below\n"
+        "  --headless        no window, no audio/video output, run as fast as possible\n"
+        "  --frames N        stop after N frames (0 = run until closed/interrupted)\n"
+        "  --core PATH       libretro core (default ./libdolphin.so)\n"
+        "  --iso PATH        game image\n"
+        "  --record PATH     record the input of every frame to a movie file\n"
+        "  --replay PATH     replay a movie file headless at maximum speed\n"
+        "  --rewind MB       keep MB of savestate history, hold backspace to rewind\n"
+        "  --rewind-interval N  snapshot every N frames (default 1)\n"
+        "  --runahead N      run N frames ahead of the real frame to hide input lag\n"
+        "  --runahead-second run ahead in a second core instance to keep audio clean\n"
+        "  --rollback N      play against a loopback peer N frames behind that mirrors port 1 onto port 2\n"
+        "  --observe         publish frames to a shared-memory channel for another process\n"
+        "  --observe-ram ADDR:SIZE  also publish SIZE bytes of RAM at hex ADDR, implies --observe\n"
+        "  --extract PATH    write per-frame player state to a columnar file\n"
+        "  --ram-log PATH    write the RAM ranges that changed each frame\n"
+        "  --watch ADDR[:SIZE]  pause when SIZE (default 4) bytes at hex ADDR change\n"
+        "  --state PATH      savestate file, F5 saves to it and F7 loads it\n"
+        "  --state-level N   zstd level for savestates (default 3)\n"
+        "  --state-every N   also save every N frames\n"
+        "  --load-state      load the savestate before the first frame\n"
+        "  --fork-server SOCKET  boot headless, then fork a run from the booted core for every\n"
+        "                    --fork-client request on SOCKET, with the client's options;\n"
+        "                    needs a single-threaded core, libdolphin is refused\n"
+        "  --boot-frames N   frames the fork-server runs before serving (default 0); runs count\n"
+        "                    frames on from N and can't --record or --replay\n",
+        argv0, argv0);
+    exit(1);
+}
 
-    struct retro_game_info gameinfo = {
-        .path = path,
-        .data = iso.ptr, 
-        .size = iso.size, 
-        .meta = NULL
-    };
-    assert(core->core_load_game(&gameinfo));
+typedef struct Options {
+    const char *core_path;
+    const char *path;
+    const char *record_path;
+    const char *extract_path;
+    const char *ram_log_path;
+    const char *state_path;
+    int state_level;
+    unsigned state_every;
+    bool load_state;
+    RamRange watches[RAMWATCH_MAX_WATCHPOINTS];
+    unsigned watch_count;
+    const char *replay_path;
+    U64 max_frames;
+    U64 rewind_mb;
+    unsigned rewind_interval;
+    unsigned runahead_frames;
+    bool runahead_secondary;
+    bool rollback;
+    unsigned rollback_latency;
+    ChannelRegion observe_regions[CHANNEL_MAX_REGIONS];
+    unsigned observe_region_count;
+    const char *fork_server_path;
+    U64 boot_frames;
+    bool headless;
+    bool observing;
+} Options;
 
-    while (!WindowShouldClose()) {
-        core->core_run();
-        printf("frame\n");
+static const Options default_options = {
+    .core_path = "./libdolphin.so",
+    .path = "/home/alex/melee/melee_vanilla.iso",
+    .state_level = SAVESTATE_DEFAULT_LEVEL,
+    .rewind_interval = 1,
+};
+
+// Returns false on an unknown or malformed option.
+bool parse_options(Options *o, int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--headless") == 0) {
+            o->headless = true;
+        } else if (strcmp(arg, "--frames") == 0 && i+1 < argc) {
+            o->max_frames = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--core") == 0 && i+1 < argc) {
+            o->core_path = argv[++i];
+        } else if (strcmp(arg, "--iso") == 0 && i+1 < argc) {
+            o->path = argv[++i];
+        } else if (strcmp(arg, "--record") == 0 && i+1 < argc) {
+            o->record_path = argv[++i];
+        } else if (strcmp(arg, "--replay") == 0 && i+1 < argc) {
+            o->replay_path = argv[++i];
+            o->headless = true;
+        } else if (strcmp(arg, "--rewind") == 0 && i+1 < argc) {
+            o->rewind_mb = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--rewind-interval") == 0 && i+1 < argc) {
+            o->rewind_interval = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--runahead") == 0 && i+1 < argc) {
+            o->runahead_frames = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--runahead-second") == 0) {
+            o->runahead_secondary = true;
+        } else if (strcmp(arg, "--rollback") == 0 && i+1 < argc) {
+            o->rollback = true;
+            o->rollback_latency = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--extract") == 0 && i+1 < argc) {
+            o->extract_path = argv[++i];
+        } else if (strcmp(arg, "--ram-log") == 0 && i+1 < argc) {
+            o->ram_log_path = argv[++i];
+        } else if (strcmp(arg, "--watch") == 0 && i+1 < argc) {
+            char *end;
+            unsigned long address = strtoul(argv[++i], &end, 16);
+            unsigned long size = *end == ':' ? strtoul(end + 1, &end, 0) : 4;
+            if (*end != '\0' || o->watch_count == RAMWATCH_MAX_WATCHPOINTS) return false;
+            o->watches[o->watch_count++] = (RamRange) { .address = (U32)address, .size = (U32)size };
+        } else if (strcmp(arg, "--state") == 0 && i+1 < argc) {
+            o->state_path = argv[++i];
+        } else if (strcmp(arg, "--state-level") == 0 && i+1 < argc) {
+            o->state_level = (int)strtol(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--state-every") == 0 && i+1 < argc) {
+            o->state_every = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--load-state") == 0) {
+            o->load_state = true;
+        } else if (strcmp(arg, "--fork-server") == 0 && i+1 < argc) {
+            o->fork_server_path = argv[++i];
+        } else if (strcmp(arg, "--boot-frames") == 0 && i+1 < argc) {
+            o->boot_frames = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--observe") == 0) {
+            o->observing = true;
+        } else if (strcmp(arg, "--observe-ram") == 0 && i+1 < argc) {
+            char *end;
+            unsigned long address = strtoul(argv[++i], &end, 16);
+            unsigned long size = *end == ':' ? strtoul(end + 1, &end, 0) : 0;
+            if (*end != '\0' || size == 0 || o->observe_region_count == CHANNEL_MAX_REGIONS) return false;
+            o->observe_regions[o->observe_region_count++] = (ChannelRegion) { .address = (U32)address, .size = (U32)size };
+            o->observing = true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Prints why and returns false if options can't be combined.
+bool check_options(const Options *o) {
+    if (o->record_path != NULL && o->rewind_mb != 0) {
+        fprintf(stderr, "--record and --rewind can't be combined, rewinding would break the movie\n");
+        return false;
+    }
+    if (o->rollback && (o->record_path != NULL || o->rewind_mb != 0 || o->runahead_frames != 0)) {
+        fprintf(stderr, "--rollback can't be combined with --record, --rewind or --runahead\n");
+        return false;
+    }
+    if (o->state_path == NULL && (o->state_every != 0 || o->load_state)) {
+        fprintf(stderr, "--state-every and --load-state need --state\n");
+        return false;
+    }
+    if (o->state_path != NULL && (o->record_path != NULL || o->rollback)) {
+        fprintf(stderr, "--state can't be combined with --record or --rollback, loading would break them\n");
+        return false;
+    }
+    if (o->rollback && o->rollback_latency >= ROLLBACK_WINDOW) {
+        fprintf(stderr, "--rollback latency must be below %u frames\n", ROLLBACK_WINDOW);
+        return false;
+    }
+    if (o->fork_server_path != NULL && !o->headless) {
+        fprintf(stderr, "--fork-server needs --headless\n");
+        return false;
+    }
+    if (o->fork_server_path == NULL && o->boot_frames != 0) {
+        fprintf(stderr, "--boot-frames needs --fork-server\n");
+        return false;
+    }
+    return true;
+}
+
+// on_exit handler of a fork-server child.
+static void send_job_status(int status, void *arg) {
+    (void)arg;
+    fflush(NULL);
+    forkserver_send_status(STDOUT_FILENO, status);
+}
+
+// In a fork-server child: reads the job sent on conn, moves to the client's
+// working directory and replaces the server's options with the job's, keeping
+// the core and game the server booted.
+// The connection becomes the job's stdin, stdout and stderr, and is sent its
+// exit status when it exits.
+bool start_job(int conn, Options *o) {
+    // The job's options point into it.
+    static ForkRequest request;
+    bool received = forkserver_read_request(conn, &request);
+    dup2(conn, STDIN_FILENO);
+    dup2(conn, STDOUT_FILENO);
+    dup2(conn, STDERR_FILENO);
+    close(conn);
+    on_exit(send_job_status, NULL);
+    if (!received) {
+        fprintf(stderr, "malformed fork-server request\n");
+        return false;
+    }
+    if (chdir(request.cwd) != 0) {
+        fprintf(stderr, "could not change to %s: %s\n", request.cwd, strerror(errno));
+        return false;
+    }
+
+    Options job = default_options;
+    job.core_path = o->core_path;
+    job.path = o->path;
+    job.headless = true;
+    if (!parse_options(&job, request.argc, request.argv)) {
+        fprintf(stderr, "unknown or malformed option in the request\n");
+        return false;
+    }
+    if (job.fork_server_path != NULL) {
+        fprintf(stderr, "--fork-server can't be sent to a fork-server\n");
+        return false;
+    }
+    if (strcmp(job.core_path, o->core_path) != 0 || strcmp(job.path, o->path) != 0) {
+        fprintf(stderr, "the fork-server has %s running %s, not the requested ones\n", o->core_path, o->path);
+        return false;
+    }
+    if (!check_options(&job)) return false;
+    // Movies start at power-on, a job starts where the server stopped booting.
+    if (o->boot_frames != 0 && (job.replay_path != NULL || job.record_path != NULL)) {
+        fprintf(stderr, "--replay and --record need a fork-server started without --boot-frames\n");
+        return false;
+    }
+
+    // Frame numbers carry on from the boot.
+    job.boot_frames = o->boot_frames;
+    *o = job;
+    headless = true;
+    observing = job.observing;
+    av_enable = observing ? RETRO_AV_ENABLE_VIDEO : 0;
+    boot_start = request.client_start;
+    signal(SIGINT, quithandler);
+    signal(SIGTERM, quithandler);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    boot_start = time_now();
+    if (argc >= 3 && strcmp(argv[1], "--fork-client") == 0)
+        return forkserver_client(argv[2], argc - 3, argv + 3);
+
+    Options o = default_options;
+    if (!parse_options(&o, argc, argv)) usage(argv[0]);
+    if (!check_options(&o)) return 1;
+    headless = o.headless;
+    observing = o.observing;
+
+    if (headless) {
+        // The channel still needs frames when nothing is shown.
+        av_enable = observing ? RETRO_AV_ENABLE_VIDEO : 0;
+        signal(SIGINT, quithandler);
+        signal(SIGTERM, quithandler);
+    } else {
+        SetTraceLogLevel(LOG_WARNING);
+        SetConfigFlags(FLAG_VSYNC_HINT);
+        InitWindow(640, 480, "dolphin");
+    }
+
+    core_functions_t *core = load_core(o.core_path);
+    if (core == NULL) {
+        fprintf(stderr, "could not load core %s\n", o.core_path);
+        return 1;
+    }
+    Bytes iso = { .ptr = NULL, .size = 0 };
+    if (!start_core(core, &env_callback, o.path, &iso)) return 1;
+
+    // Everything past this point is per job: each fork-server child gets here
+    // with the core booted and its own options in place of the server's.
+    if (o.fork_server_path != NULL) {
+        InputSnapshot idle = { 0 };
+        for (U64 i = 0; i < o.boot_frames && !quit_requested; ++i) {
+            input_publish(&idle);
+            core->core_run();
+        }
+        if (quit_requested) return 0;
+        printf("booted to frame %lu in %.1fms, serving on %s\n",
+            o.boot_frames, (time_now() - boot_start) * 1e3, o.fork_server_path);
+        fflush(stdout);
+
+        int conn;
+        if (!forkserver_serve(o.fork_server_path, &conn)) return 1;
+        if (conn < 0) return 0;
+        if (!start_job(conn, &o)) return 1;
+    }
+
+    MovieReader replay;
+    if (o.replay_path != NULL && !movie_reader_open(&replay, o.replay_path)) {
+        fprintf(stderr, "could not read movie %s\n", o.replay_path);
+        return 1;
+    }
+    MovieWriter record;
+    if (o.record_path != NULL && !movie_writer_open(&record, o.record_path)) {
+        fprintf(stderr, "could not create movie %s: %s\n", o.record_path, strerror(errno));
+        return 1;
+    }
+
+    core_functions_t *secondary = NULL;
+    if (o.runahead_frames != 0 && o.runahead_secondary) {
+        secondary = load_core_isolated(o.core_path);
+        if (secondary == NULL || !start_core(secondary, &secondary_env_callback, o.path, &iso)) {
+            fprintf(stderr, "could not start a second core instance for run-ahead\n");
+            return 1;
+        }
+    }
+
+    struct retro_system_av_info av_info;
+    core->core_get_system_av_info(&av_info);
+    video_set_geometry(&av_info.geometry);
+    audio_start(av_info.timing.sample_rate);
+
+    if (memory.count == 0 && core->core_get_memory_data != NULL && core->core_get_memory_size != NULL) {
+        // Without a memory map, MEM1 is all there is to read.
+        struct retro_memory_descriptor mem1 = {
+            .ptr = core->core_get_memory_data(RETRO_MEMORY_SYSTEM_RAM),
+            .start = GC_MEM1_START,
+            .len = core->core_get_memory_size(RETRO_MEMORY_SYSTEM_RAM),
+        };
+        struct retro_memory_map map = { .descriptors = &mem1, .num_descriptors = 1 };
+        if (mem1.ptr != NULL) memmap_set(&memory, &map);
+    }
+    if (observing) {
+        for (unsigned i = 0; i < o.observe_region_count; ++i) {
+            const ChannelRegion *r = &o.observe_regions[i];
+            if (memmap_translate(&memory, r->address, r->size) == NULL) {
+                fprintf(stderr, "RAM region %08x:%u is not mapped\n", r->address, r->size);
+                return 1;
+            }
+        }
+        if (!channel_create(&observe, av_info.geometry.max_width, av_info.geometry.max_height,
+            o.observe_regions, o.observe_region_count)
+        ) {
+            fprintf(stderr, "could not create the observation channel: %s\n", strerror(errno));
+            return 1;
+        }
+        printf("observation channel at /proc/%d/fd/%d\n", getpid(), observe.fd);
+        fflush(stdout);
+    }
+
+    Extractor extract;
+    if (o.extract_path != NULL && !extract_open(&extract, o.extract_path, &memory, melee_fields, melee_field_count)) {
+        fprintf(stderr, "could not create %s: %s\n", o.extract_path, strerror(errno));
+        return 1;
+    }
+
+    bool watching = o.ram_log_path != NULL || o.watch_count != 0;
+    RamWatch ramwatch;
+    FILE *ram_log = NULL;
+    if (watching) {
+        const U8 *mem1 = core->core_get_memory_data ? core->core_get_memory_data(RETRO_MEMORY_SYSTEM_RAM) : NULL;
+        size_t mem1_size = core->core_get_memory_size ? core->core_get_memory_size(RETRO_MEMORY_SYSTEM_RAM) : 0;
+        if (!ramwatch_init(&ramwatch, mem1, mem1_size, GC_MEM1_START)) {
+            fprintf(stderr, "could not watch RAM, the core does not expose system RAM\n");
+            return 1;
+        }
+        for (unsigned i = 0; i < o.watch_count; ++i) {
+            if (!ramwatch_add(&ramwatch, o.watches[i].address, o.watches[i].size)) {
+                fprintf(stderr, "can't watch %08x:%u, it must be 1 to 4 bytes inside MEM1\n",
+                    o.watches[i].address, o.watches[i].size);
+                return 1;
+            }
+        }
+        if (o.ram_log_path != NULL && (ram_log = fopen(o.ram_log_path, "w")) == NULL) {
+            fprintf(stderr, "could not create %s: %s\n", o.ram_log_path, strerror(errno));
+            return 1;
+        }
+    }
+
+    Rewind rewind;
+    if (o.rewind_mb != 0 && !rewind_init(&rewind, core, o.rewind_mb << 20, o.rewind_interval, REWIND_KEYFRAME_EVERY)) {
+        fprintf(stderr, "could not set up rewind, is %luMB enough for one savestate?\n", o.rewind_mb);
+        return 1;
+    }
+
+    Runahead runahead;
+    if (o.runahead_frames != 0 && !runahead_init(&runahead, core, secondary, o.runahead_frames, &av_enable)) {
+        fprintf(stderr, "could not set up run-ahead, the core must support savestates\n");
+        return 1;
+    }
+
+    Rollback rb;
+    Loopback peer;
+    if (o.rollback && !rollback_init(&rb, core, loopback_transport(&peer, o.rollback_latency), 0, 1, &av_enable)) {
+        fprintf(stderr, "could not set up rollback, the core must support savestates\n");
+        return 1;
+    }
+
+    Savestates states;
+    if (o.state_path != NULL) {
+        if (!savestate_init(&states, core, o.state_level)) {
+            fprintf(stderr, "could not set up savestates, the core must support them and the level must be valid zstd\n");
+            return 1;
+        }
+        U64 state_frame;
+        if (o.load_state) {
+            if (!savestate_load(&states, o.state_path, &state_frame)) {
+                fprintf(stderr, "could not load savestate %s\n", o.state_path);
+                return 1;
+            }
+            printf("loaded savestate from frame %lu\n", state_frame);
+        } else if (access(o.state_path, R_OK) == 0) {
+            // Have it decompressed by the time F7 is pressed.
+            savestate_prefetch(&states, o.state_path);
+        }
+    }
+    bool state_load_wanted = false;
+
+    // A frame rollback stalled on is tried again with the same input.
+    InputSnapshot snapshot = { 0 };
+    bool stalled = false;
+
+    U64 frames = o.boot_frames;
+    double start = time_now();
+    while (!quit_requested && (o.max_frames == 0 || frames - o.boot_frames < o.max_frames)) {
+        if (!headless && WindowShouldClose()) break;
+        if (paused && !pause_wait()) break;
+
+        // While rewinding, each frame restores an older snapshot and runs one
+        // frame from it to present it; those frames are not snapshotted again.
+        bool rewound = o.rewind_mb != 0 && !headless && IsKeyDown(KEY_BACKSPACE)
+            && rewind_step_back(&rewind);
+
+        if (!stalled) {
+            snapshot = (InputSnapshot){ 0 };
+            if (o.replay_path != NULL) {
+                if (!movie_reader_next(&replay, &snapshot)) break;
+            } else if (!headless) {
+                input_read_devices(&snapshot);
+            }
+        }
+
+        audio_report_status();
+        if (o.rollback) {
+            RollbackStatus status = rollback_run(&rb, &snapshot);
+            if (status == ROLLBACK_FAILED) {
+                fprintf(stderr, "rollback failed, the core could not save or load a state\n");
+                break;
+            }
+            stalled = status == ROLLBACK_STALLED;
+            if (stalled) {
+                // Keep the window responsive while the peer catches up.
+                if (!headless) video_present();
+                continue;
+            }
+        } else {
+            input_publish(&snapshot);
+            if (o.runahead_frames != 0) runahead_run(&runahead);
+            else core->core_run();
+        }
+        frames++;
+        if (frames == o.boot_frames + 1) printf("boot to first frame: %.1fms\n", (time_now() - boot_start) * 1e3);
+        if (observing) channel_publish(&observe, frames, &memory);
+        if (o.extract_path != NULL && !extract_frame(&extract, frames)) {
+            fprintf(stderr, "could not write to %s\n", o.extract_path);
+            break;
+        }
+        if (watching) {
+            if (ramwatch_scan(&ramwatch)) {
+                for (unsigned i = 0; i < ramwatch.watchpoint_count; ++i) {
+                    const Watchpoint *wp = &ramwatch.watchpoints[i];
+                    if (wp->hit)
+                        printf("frame %lu: watchpoint %08x changed %x -> %x\n", frames, wp->address, wp->old, wp->new);
+                }
+                paused = true;
+            }
+            if (ram_log != NULL) ramwatch_log(&ramwatch, ram_log, frames);
+        }
+
+        if (o.rewind_mb != 0 && !rewound) rewind_push(&rewind);
+
+        if (o.state_path != NULL) {
+            bool save = o.state_every != 0 && frames % o.state_every == 0;
+            if (!headless && IsKeyPressed(KEY_F5)) save = true;
+            if (save && !savestate_save(&states, o.state_path, frames))
+                fprintf(stderr, "savestate at frame %lu dropped, the writer is behind\n", frames);
+
+            if (!headless && IsKeyPressed(KEY_F7)) {
+                savestate_prefetch(&states, o.state_path);
+                state_load_wanted = true;
+            }
+            // The load lands on the first frame after the loader is done.
+            U64 state_frame;
+            LoadStatus status = state_load_wanted ? savestate_poll_load(&states, &state_frame) : LOAD_PENDING;
+            if (status == LOAD_READY) printf("loaded savestate from frame %lu\n", state_frame);
+            else if (status != LOAD_PENDING) fprintf(stderr, "could not load savestate %s\n", o.state_path);
+            if (status != LOAD_PENDING) state_load_wanted = false;
+        }
+
+        if (o.record_path != NULL && !movie_writer_add(&record, input_current())) {
+            fprintf(stderr, "could not write to %s\n", o.record_path);
+            break;
+        }
+
+        if (!headless) audio_pace();
+    }
+    double elapsed = time_now() - start;
+
+    if (o.state_path != NULL) {
+        savestate_deinit(&states);
+        const SavestateStats *st = &states.stats;
+        if (st->saves != 0) {
+            double saves = (double)st->saves;
+            printf("savestates: %lu saved, %lu dropped, %lu failed, %.1fMB -> %.1fMB\n",
+                st->saves, st->dropped, st->failed,
+                (double)st->state_bytes / saves / (1 << 20), (double)st->written_bytes / saves / (1 << 20));
+            printf("savestates: serialize %.3fms, queued %.3fms, compress %.3fms, write %.3fms per save\n",
+                st->serialize_time / saves * 1e3, st->queue_time / saves * 1e3,
+                st->compress_time / saves * 1e3, st->write_time / saves * 1e3);
+        }
+        if (st->loads != 0) {
+            double loads = (double)st->loads;
+            printf("savestates: %lu loaded, read %.3fms, decompress %.3fms, unserialize %.3fms per load\n",
+                st->loads, st->read_time / loads * 1e3, st->decompress_time / loads * 1e3,
+                st->unserialize_time / loads * 1e3);
+        }
+    }
+    if (watching) {
+        double scans = (double)ramwatch.scans;
+        printf("ram watch: %lu scans, %.0f changed bytes per frame, %.3fms per scan\n",
+            ramwatch.scans, scans > 0.0 ? (double)ramwatch.changed_bytes / scans : 0.0,
+            scans > 0.0 ? ramwatch.scan_time / scans * 1e3 : 0.0);
+        if (ram_log != NULL) fclose(ram_log);
+        ramwatch_deinit(&ramwatch);
+    }
+    if (o.extract_path != NULL) {
+        if (!extract_close(&extract))
+            fprintf(stderr, "could not finish %s\n", o.extract_path);
+        else
+            printf("extracted %lu frames to %s\n", extract.total_rows, o.extract_path);
+    }
+    if (o.record_path != NULL && !movie_writer_close(&record))
+        fprintf(stderr, "could not finish movie %s\n", o.record_path);
+    if (o.replay_path != NULL) {
+        if (replay.frame < replay.frames)
+            printf("replay stopped at frame %u of %u\n", replay.frame, replay.frames);
+        movie_reader_close(&replay);
+    }
+    U64 run_frames = frames - o.boot_frames;
+    printf("%lu frames in %.3fs (%.1f fps)\n", run_frames, elapsed, elapsed > 0.0 ? (double)run_frames / elapsed : 0.0);
+    if (video.frames != 0)
+        printf("%lu of %lu video frames were duplicates\n", video.dup_frames, video.frames);
+    AudioStats audio = audio_stats();
+    if (audio.capacity != 0) {
+        printf("audio: %lu frames in, %lu dropped, %lu out, %lu underrun, rate %+.3f%%\n",
+            audio.pushed_frames, audio.dropped_frames, audio.output_frames, audio.underrun_frames,
+            (audio.rate_adjust - 1.0) * 100.0);
+    }
+    if (o.runahead_frames != 0 && runahead.stats.runs != 0) {
+        RunaheadStats *st = &runahead.stats;
+        double runs = (double)st->runs;
+        printf("run-ahead %u%s: real frame %.3fms, serialize %.3fms, unserialize %.3fms, %.3fms per ahead frame\n",
+            o.runahead_frames, secondary != NULL ? " (second instance)" : "",
+            st->real_time / runs * 1e3, st->serialize_time / runs * 1e3,
+            st->unserialize_time / runs * 1e3, st->ahead_time / (double)st->ahead_frames * 1e3);
+    }
+    if (o.rollback && rb.stats.frames != 0) {
+        RollbackStats *st = &rb.stats;
+        printf("rollback: %lu rollbacks over %lu frames, depth %.1f mean, %u max, %lu stalls\n",
+            st->rollbacks, st->frames,
+            st->rollbacks ? (double)st->resimulated_frames / (double)st->rollbacks : 0.0,
+            st->max_depth, st->stalls);
+        printf("rollback: save %.3fms, load %.3fms, resimulate %.3fms per rollback\n",
+            st->save_time / (double)st->saves * 1e3,
+            st->rollbacks ? st->load_time / (double)st->rollbacks * 1e3 : 0.0,
+            st->rollbacks ? st->resimulate_time / (double)st->rollbacks * 1e3 : 0.0);
+    }
+    if (o.rewind_mb != 0) {
+        size_t used = rewind_used(&rewind);
+        double used_mb = (double)used / (1 << 20);
+        printf("rewind: %lu snapshots, %lu evicted, %zu held in %.1fMB of %luMB\n",
+            rewind.pushed, rewind.evicted, rewind.entry_count,
+            used_mb, o.rewind_mb);
     }
 
     //core->core_unload_game();
@@ -0,0 +1,134 @@
+#include "memmap.h"
+
+#include <stdlib.h>
+
+// Removes the bits set in mask from addr, shifting the bits above each one
+// down, which is how libretro descriptors drop disconnected address lines.
+static size_t reduce(size_t addr, size_t mask) {
+    while (mask) {
+        size_t low = (mask - 1) & ~mask;
+        addr = (addr & low) | ((addr >> 1) & ~low);
+        mask = (mask & (mask - 1)) >> 1;
+    }
+    return addr;
+}
+
+static bool descriptor_matches(const struct retro_memory_descriptor *d, U32 address) {
+    if (d->ptr == NULL || d->len == 0) return false;
+    if (d->select != 0) return (address & d->select) == (d->start & d->select);
+    return address >= d->start && address - d->start < d->len;
+}
+
+// Offset into d->ptr for an address d matches.
+static size_t descriptor_offset(const struct retro_memory_descriptor *d, U32 address) {
+    size_t offset = (size_t)address - d->start;
+    if (d->select != 0) offset &= ~d->select;
+    offset = reduce(offset, d->disconnect);
+    if (offset >= d->len) offset %= d->len;
+    return d->offset + offset;
+}
+
+static const struct retro_memory_descriptor *find(const MemoryMap *m, U32 address) {
+    for (unsigned i = 0; i < m->count; ++i)
+        if (descriptor_matches(&m->descriptors[i], address)) return &m->descriptors[i];
+    return NULL;
+}
+
+// Whether d could claim any address in the page starting at base.
+static bool descriptor_touches_page(const struct retro_memory_descriptor *d, U32 base) {
+    if (d->ptr == NULL || d->len == 0) return false;
+    if (d->select != 0) {
+        size_t select = d->select & ~(size_t)(MEMMAP_PAGE_SIZE - 1);
+        return (base & select) == (d->start & select);
+    }
+    return d->start < (size_t)base + MEMMAP_PAGE_SIZE && (size_t)base < d->start + d->len;
+}
+
+// Host pointer to the page at base if one descriptor maps all of it in order.
+static U8 *linear_page(const MemoryMap *m, U32 base) {
+    for (unsigned i = 0; i < m->count; ++i) {
+        const struct retro_memory_descriptor *d = &m->descriptors[i];
+        if (!descriptor_touches_page(d, base)) continue;
+
+        // The first descriptor that touches the page has to own all of it.
+        U32 last = base + (MEMMAP_PAGE_SIZE - 1);
+        if (!descriptor_matches(d, base) || !descriptor_matches(d, last)) return NULL;
+        if ((d->select & (MEMMAP_PAGE_SIZE - 1)) != 0) return NULL;
+        if ((d->disconnect & (MEMMAP_PAGE_SIZE - 1)) != 0) return NULL;
+        size_t first = descriptor_offset(d, base);
+        if (descriptor_offset(d, last) != first + (MEMMAP_PAGE_SIZE - 1)) return NULL;
+        return (U8 *)d->ptr + first;
+    }
+    return NULL;
+}
+
+bool memmap_set(MemoryMap *m, const struct retro_memory_map *map) {
+    memmap_clear(m);
+    if (map == NULL || map->num_descriptors == 0) return true;
+
+    m->descriptors = malloc(map->num_descriptors * sizeof(*m->descriptors));
+    m->pages = calloc(MEMMAP_PAGES, sizeof(*m->pages));
+    if (m->descriptors == NULL || m->pages == NULL) {
+        memmap_clear(m);
+        return false;
+    }
+    memcpy(m->descriptors, map->descriptors, map->num_descriptors * sizeof(*m->descriptors));
+    m->count = map->num_descriptors;
+
+    for (U32 page = 0; page < MEMMAP_PAGES; ++page)
+        m->pages[page] = linear_page(m, page << MEMMAP_PAGE_BITS);
+    return true;
+}
+
+void memmap_clear(MemoryMap *m) {
+    free(m->descriptors);
+    free(m->pages);
+    memset(m, 0, sizeof(*m));
+}
+
+U8 *memmap_translate(const MemoryMap *m, U32 address, size_t size) {
+    if (m->count == 0 || size == 0 || (U64)address + size > (U64)1 << 32) return NULL;
+
+    U32 page = address >> MEMMAP_PAGE_BITS;
+    U32 last_page = (U32)(((U64)address + size - 1) >> MEMMAP_PAGE_BITS);
+    U8 *p = m->pages[page];
+    if (p != NULL) {
+        // Following pages only count if they continue the same host memory.
+        for (U32 next = page + 1; next <= last_page; ++next)
+            if (m->pages[next] != p + (size_t)(next - page) * MEMMAP_PAGE_SIZE) return NULL;
+        return p + (address & (MEMMAP_PAGE_SIZE - 1));
+    }
+
+    const struct retro_memory_descriptor *d = find(m, address);
+    if (d == NULL) return NULL;
+    U32 last = (U32)(address + size - 1);
+    size_t offset = descriptor_offset(d, address);
+    if (find(m, last) != d || descriptor_offset(d, last) != offset + size - 1) return NULL;
+    return (U8 *)d->ptr + offset;
+}
+
+bool memmap_read(const MemoryMap *m, U32 address, void *dst, size_t size) {
+    U8 *out = dst;
+    while (size != 0) {
+        // Copy up to the end of the page in one go when it is mapped linearly.
+        size_t chunk = MEMMAP_PAGE_SIZE - (address & (MEMMAP_PAGE_SIZE - 1));
+        if (chunk > size) chunk = size;
+
+        const U8 *src = m->count ? m->pages[address >> MEMMAP_PAGE_BITS] : NULL;
+        if (src != NULL) {
+            memcpy(out, src + (address & (MEMMAP_PAGE_SIZE - 1)), chunk);
+        } else {
+            for (size_t i = 0; i < chunk; ++i) {
+                const struct retro_memory_descriptor *d = find(m, address + (U32)i);
+                if (d == NULL) return false;
+                out[i] = ((const U8 *)d->ptr)[descriptor_offset(d, address + (U32)i)];
+            }
+        }
+
+        out += chunk;
+        size -= chunk;
+        if (size != 0 && (U64)address + chunk > UINT32_MAX) return false;
+        address += (U32)chunk;
+    }
+    return true;
+}
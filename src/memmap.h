@@ -0,0 +1,83 @@
+#ifndef MEMMAP_H
+#define MEMMAP_H
+
+#include "libretro.h"
+#include "types.h"
+
+#include <string.h>
+
+// Guest address lookup built from RETRO_ENVIRONMENT_SET_MEMORY_MAPS. The
+// descriptors are kept in the core's priority order, and a flat table over the
+// 32-bit address space holds, for every 64KB page one descriptor maps
+// linearly, the host pointer to the start of that page. Translating a
+// GameCube address such as a player block at 0x80453080 is then one table
+// load. Pages that are unmapped, split between descriptors or scrambled by
+// disconnect bits fall back to walking the descriptors.
+
+#define MEMMAP_PAGE_BITS 16
+#define MEMMAP_PAGE_SIZE (1u << MEMMAP_PAGE_BITS)
+#define MEMMAP_PAGES (1u << (32 - MEMMAP_PAGE_BITS))
+
+typedef struct MemoryMap {
+    struct retro_memory_descriptor *descriptors;
+    unsigned count;
+    U8 **pages;
+} MemoryMap;
+
+// Copies the descriptors and builds the page table, replacing any earlier map.
+bool memmap_set(MemoryMap *m, const struct retro_memory_map *map);
+void memmap_clear(MemoryMap *m);
+
+// Host pointer to size contiguous bytes at address, or NULL if they are not
+// all mapped back to back.
+U8 *memmap_translate(const MemoryMap *m, U32 address, size_t size);
+
+// Copies size bytes starting at address, across pages and descriptors.
+// Returns false if any byte is unmapped.
+bool memmap_read(const MemoryMap *m, U32 address, void *dst, size_t size);
+
+// BIG ENDIAN ###################################################################
+
+// GameCube memory is big endian and is kept that way by the core.
+
+static inline U16 be16(const U8 *p) {
+    return (U16)((p[0] << 8) | p[1]);
+}
+
+static inline U32 be32(const U8 *p) {
+    return ((U32)p[0] << 24) | ((U32)p[1] << 16) | ((U32)p[2] << 8) | p[3];
+}
+
+static inline float bef32(const U8 *p) {
+    U32 bits = be32(p);
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static inline bool memmap_read_u8(const MemoryMap *m, U32 address, U8 *out) {
+    return memmap_read(m, address, out, 1);
+}
+
+static inline bool memmap_read_u16(const MemoryMap *m, U32 address, U16 *out) {
+    U8 b[2];
+    if (!memmap_read(m, address, b, sizeof(b))) return false;
+    *out = be16(b);
+    return true;
+}
+
+static inline bool memmap_read_u32(const MemoryMap *m, U32 address, U32 *out) {
+    U8 b[4];
+    if (!memmap_read(m, address, b, sizeof(b))) return false;
+    *out = be32(b);
+    return true;
+}
+
+static inline bool memmap_read_f32(const MemoryMap *m, U32 address, float *out) {
+    U8 b[4];
+    if (!memmap_read(m, address, b, sizeof(b))) return false;
+    *out = bef32(b);
+    return true;
+}
+
+#endif
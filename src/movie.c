@@ -0,0 +1,185 @@
+#include "movie.h"
+
+#include <string.h>
+
+#define MOVIE_FIELDS 7
+
+static U16 field_get(const InputPort *p, unsigned i) {
+    if (i == 0) return p->buttons;
+    if (i < 5) return (U16)p->axes[i - 1];
+    return (U16)p->triggers[i - 5];
+}
+
+static void field_set(InputPort *p, unsigned i, U16 v) {
+    if (i == 0) p->buttons = v;
+    else if (i < 5) p->axes[i - 1] = (I16)v;
+    else p->triggers[i - 5] = (I16)v;
+}
+
+static bool port_equal(const InputPort *a, const InputPort *b) {
+    for (unsigned i = 0; i < MOVIE_FIELDS; ++i)
+        if (field_get(a, i) != field_get(b, i)) return false;
+    return true;
+}
+
+static void put_u16(U8 *p, U16 v) {
+    p[0] = (U8)v;
+    p[1] = (U8)(v >> 8);
+}
+
+static void put_u32(U8 *p, U32 v) {
+    put_u16(p, (U16)v);
+    put_u16(p + 2, (U16)(v >> 16));
+}
+
+static U16 get_u16(const U8 *p) {
+    return (U16)(p[0] | (p[1] << 8));
+}
+
+static U32 get_u32(const U8 *p) {
+    return (U32)get_u16(p) | ((U32)get_u16(p + 2) << 16);
+}
+
+// WRITER #######################################################################
+
+static bool write_header(FILE *f, U32 frames) {
+    U8 header[MOVIE_HEADER_SIZE] = { 0 };
+    memcpy(header, MOVIE_MAGIC, 4);
+    put_u16(header + 4, MOVIE_VERSION);
+    put_u16(header + 6, INPUT_PORTS);
+    put_u32(header + 8, frames);
+    return fwrite(header, sizeof(header), 1, f) == 1;
+}
+
+// Emits the pending run of w->current, delta encoded against w->written.
+static bool flush_run(MovieWriter *w) {
+    if (w->run == 0) return true;
+
+    U8 buf[10 + 1 + INPUT_PORTS * (1 + MOVIE_FIELDS * 2)];
+    size_t n = 0;
+
+    U64 run = w->run;
+    do {
+        U8 byte = run & 0x7F;
+        run >>= 7;
+        buf[n++] = run ? (byte | 0x80) : byte;
+    } while (run);
+
+    size_t mask_at = n++;
+    U8 port_mask = 0;
+    for (unsigned p = 0; p < INPUT_PORTS; ++p) {
+        const InputPort *cur = &w->current.ports[p];
+        const InputPort *old = &w->written.ports[p];
+        if (port_equal(cur, old)) continue;
+        port_mask |= (U8)(1u << p);
+
+        size_t fields_at = n++;
+        U8 field_mask = 0;
+        for (unsigned i = 0; i < MOVIE_FIELDS; ++i) {
+            U16 v = field_get(cur, i);
+            if (v == field_get(old, i)) continue;
+            field_mask |= (U8)(1u << i);
+            put_u16(buf + n, v);
+            n += 2;
+        }
+        buf[fields_at] = field_mask;
+    }
+    buf[mask_at] = port_mask;
+
+    w->written = w->current;
+    w->run = 0;
+    return fwrite(buf, n, 1, w->f) == 1;
+}
+
+bool movie_writer_open(MovieWriter *w, const char *path) {
+    memset(w, 0, sizeof(*w));
+    w->f = fopen(path, "wb");
+    if (w->f == NULL) return false;
+    return write_header(w->f, 0);
+}
+
+bool movie_writer_add(MovieWriter *w, const InputSnapshot *snapshot) {
+    bool ok = true;
+    if (w->run != 0 && memcmp(&w->current, snapshot, sizeof(*snapshot)) != 0)
+        ok = flush_run(w);
+    w->current = *snapshot;
+    w->run++;
+    w->frames++;
+    return ok;
+}
+
+// Flushes the last run and patches the frame count into the header.
+bool movie_writer_close(MovieWriter *w) {
+    if (w->f == NULL) return false;
+    bool ok = flush_run(w);
+    ok = ok && fseek(w->f, 0, SEEK_SET) == 0 && write_header(w->f, w->frames);
+    ok = (fclose(w->f) == 0) && ok;
+    w->f = NULL;
+    return ok;
+}
+
+// READER #######################################################################
+
+bool movie_reader_open(MovieReader *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+    r->file = map_file(path);
+    if (r->file.ptr == NULL) return false;
+
+    const U8 *h = r->file.ptr;
+    if (r->file.size < MOVIE_HEADER_SIZE
+        || memcmp(h, MOVIE_MAGIC, 4) != 0
+        || get_u16(h + 4) != MOVIE_VERSION
+        || get_u16(h + 6) != INPUT_PORTS
+    ) {
+        movie_reader_close(r);
+        return false;
+    }
+    r->frames = get_u32(h + 8);
+    r->pos = MOVIE_HEADER_SIZE;
+    return true;
+}
+
+static bool read_record(MovieReader *r) {
+    const U8 *p = r->file.ptr;
+    U64 size = r->file.size;
+
+    U64 run = 0;
+    for (unsigned shift = 0;; shift += 7) {
+        if (r->pos >= size || shift > 63) return false;
+        U8 byte = p[r->pos++];
+        run |= (U64)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) break;
+    }
+
+    if (r->pos >= size) return false;
+    U8 port_mask = p[r->pos++];
+    for (unsigned port = 0; port < INPUT_PORTS; ++port) {
+        if ((port_mask & (1u << port)) == 0) continue;
+        if (r->pos >= size) return false;
+        U8 field_mask = p[r->pos++];
+        for (unsigned i = 0; i < MOVIE_FIELDS; ++i) {
+            if ((field_mask & (1u << i)) == 0) continue;
+            if (r->pos + 2 > size) return false;
+            field_set(&r->current.ports[port], i, get_u16(p + r->pos));
+            r->pos += 2;
+        }
+    }
+
+    r->run = run;
+    return run != 0;
+}
+
+bool movie_reader_next(MovieReader *r, InputSnapshot *snapshot) {
+    if (r->file.ptr == NULL || r->frame >= r->frames) return false;
+    if (r->run == 0 && !read_record(r)) return false;
+
+    *snapshot = r->current;
+    r->run--;
+    r->frame++;
+    return true;
+}
+
+void movie_reader_close(MovieReader *r) {
+    unmap_file(r->file);
+    memset(r, 0, sizeof(*r));
+}
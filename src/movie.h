@@ -0,0 +1,53 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include "input.h"
+#include "file.h"
+
+#include <stdio.h>
+
+// Binary input movies: the snapshot the core saw on every frame, for all
+// four ports, delta and run-length encoded.
+//
+// header   "DEMV", U16 version, U16 ports, U32 frames, U32 reserved
+// records  varint run            frames the snapshot is held for
+//          U8 port mask          ports that differ from the previous record
+//          per changed port:
+//            U8 field mask       bit 0 buttons, bits 1-4 axes, bits 5-6 triggers
+//            changed fields      little endian 16-bit values in field order
+//
+// Integers are little endian. An idle controller costs two bytes per run of
+// identical frames regardless of its length.
+
+#define MOVIE_MAGIC "DEMV"
+#define MOVIE_VERSION 1
+#define MOVIE_HEADER_SIZE 16
+
+typedef struct MovieWriter {
+    FILE *f;
+    U32 frames;
+    U64 run;
+    InputSnapshot current;
+    InputSnapshot written;
+} MovieWriter;
+
+typedef struct MovieReader {
+    Bytes file;
+    U64 pos;
+    U32 frames;
+    U32 frame;
+    U64 run;
+    InputSnapshot current;
+} MovieReader;
+
+bool movie_writer_open(MovieWriter *w, const char *path);
+bool movie_writer_add(MovieWriter *w, const InputSnapshot *snapshot);
+bool movie_writer_close(MovieWriter *w);
+
+// The file is mmapped and decoded in place as frames are requested.
+bool movie_reader_open(MovieReader *r, const char *path);
+// Returns false once every frame has been read or the file is truncated.
+bool movie_reader_next(MovieReader *r, InputSnapshot *snapshot);
+void movie_reader_close(MovieReader *r);
+
+#endif
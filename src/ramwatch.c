@@ -0,0 +1,166 @@
+#include "ramwatch.h"
+#include "clock.h"
+#include "simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK 64
+
+bool ramwatch_init(RamWatch *w, const U8 *mem, size_t size, U32 base) {
+    memset(w, 0, sizeof(*w));
+    if (mem == NULL || size == 0) return false;
+    w->mem = mem;
+    w->size = size;
+    w->base = base;
+    w->prev = malloc(size);
+    w->range_capacity = 1024;
+    w->ranges = malloc(w->range_capacity * sizeof(RamRange));
+    if (w->prev == NULL || w->ranges == NULL) {
+        ramwatch_deinit(w);
+        return false;
+    }
+    memcpy(w->prev, mem, size);
+    return true;
+}
+
+void ramwatch_deinit(RamWatch *w) {
+    free(w->prev);
+    free(w->ranges);
+    memset(w, 0, sizeof(*w));
+}
+
+bool ramwatch_add(RamWatch *w, U32 address, U32 size) {
+    if (w->watchpoint_count == RAMWATCH_MAX_WATCHPOINTS || size == 0 || size > 4) return false;
+    if (address < w->base || (size_t)(address - w->base) + size > w->size) return false;
+    w->watchpoints[w->watchpoint_count++] = (Watchpoint) { .address = address, .size = size };
+    return true;
+}
+
+static void push_range(RamWatch *w, size_t offset, size_t size) {
+    w->changed_bytes += size;
+    U32 address = w->base + (U32)offset;
+    if (w->range_count != 0) {
+        RamRange *last = &w->ranges[w->range_count - 1];
+        if (address <= last->address + last->size + RAMWATCH_MERGE_GAP) {
+            last->size = address + (U32)size - last->address;
+            return;
+        }
+    }
+    if (w->range_count == w->range_capacity) {
+        RamRange *grown = realloc(w->ranges, w->range_capacity * 2 * sizeof(RamRange));
+        // Out of memory: the list ends early rather than losing the scan.
+        if (grown == NULL) return;
+        w->ranges = grown;
+        w->range_capacity *= 2;
+    }
+    w->ranges[w->range_count++] = (RamRange) { address, (U32)size };
+}
+
+// Bit i of changed set means byte offset + i differs.
+static void push_block(RamWatch *w, size_t offset, U64 changed) {
+    while (changed) {
+        unsigned start = (unsigned)__builtin_ctzll(changed);
+        U64 run = ~(changed >> start);
+        unsigned len = run == 0 ? 64 - start : (unsigned)__builtin_ctzll(run);
+        push_range(w, offset + start, len);
+        changed &= len + start >= 64 ? 0 : ~UINT64_C(0) << (start + len);
+    }
+}
+
+static void diff_bytes(RamWatch *w, size_t from, size_t to) {
+    for (size_t off = from; off < to;) {
+        if (w->mem[off] == w->prev[off]) {
+            off++;
+            continue;
+        }
+        size_t start = off;
+        while (off < to && w->mem[off] != w->prev[off]) off++;
+        push_range(w, start, off - start);
+        memcpy(w->prev + start, w->mem + start, off - start);
+    }
+}
+
+static size_t diff_scalar(RamWatch *w) {
+    size_t off = 0;
+    for (; off + BLOCK <= w->size; off += BLOCK) {
+        if (memcmp(w->mem + off, w->prev + off, BLOCK) == 0) continue;
+        U64 changed = 0;
+        for (unsigned i = 0; i < BLOCK; ++i)
+            changed |= (U64)(w->mem[off + i] != w->prev[off + i]) << i;
+        push_block(w, off, changed);
+        memcpy(w->prev + off, w->mem + off, BLOCK);
+    }
+    return off;
+}
+
+#if HAVE_X86
+
+AVX2 static size_t diff_avx2(RamWatch *w) {
+    size_t off = 0;
+    for (; off + BLOCK <= w->size; off += BLOCK) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i*)(w->mem + off));
+        __m256i a1 = _mm256_loadu_si256((const __m256i*)(w->mem + off + 32));
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)(w->prev + off));
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(w->prev + off + 32));
+        U32 eq0 = (U32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a0, b0));
+        U32 eq1 = (U32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a1, b1));
+        U64 changed = ~((U64)eq0 | ((U64)eq1 << 32));
+        if (changed == 0) continue;
+
+        push_block(w, off, changed);
+        _mm256_storeu_si256((__m256i*)(w->prev + off), a0);
+        _mm256_storeu_si256((__m256i*)(w->prev + off + 32), a1);
+    }
+    return off;
+}
+
+#endif
+
+typedef size_t (*DiffFn)(RamWatch *w);
+
+static DiffFn diff_select(void) {
+#if HAVE_X86
+    if (__builtin_cpu_supports("avx2")) return diff_avx2;
+#endif
+    return diff_scalar;
+}
+
+static U32 read_be(const U8 *p, U32 size) {
+    U32 v = 0;
+    for (U32 i = 0; i < size; ++i) v = (v << 8) | p[i];
+    return v;
+}
+
+bool ramwatch_scan(RamWatch *w) {
+    static DiffFn diff = NULL;
+    if (diff == NULL) diff = diff_select();
+    double start = time_now();
+
+    bool hit = false;
+    for (unsigned i = 0; i < w->watchpoint_count; ++i) {
+        Watchpoint *wp = &w->watchpoints[i];
+        size_t off = wp->address - w->base;
+        wp->hit = memcmp(w->mem + off, w->prev + off, wp->size) != 0;
+        if (!wp->hit) continue;
+        wp->old = read_be(w->prev + off, wp->size);
+        wp->new = read_be(w->mem + off, wp->size);
+        hit = true;
+    }
+
+    w->range_count = 0;
+    size_t done = diff(w);
+    diff_bytes(w, done, w->size);
+
+    w->scans++;
+    w->scan_time += time_now() - start;
+    return hit;
+}
+
+void ramwatch_log(const RamWatch *w, FILE *f, U64 frame) {
+    if (w->range_count == 0) return;
+    fprintf(f, "%lu:", frame);
+    for (size_t i = 0; i < w->range_count; ++i)
+        fprintf(f, " %08x+%x", w->ranges[i].address, w->ranges[i].size);
+    fputc('\n', f);
+}
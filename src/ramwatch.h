@@ -0,0 +1,61 @@
+#ifndef RAMWATCH_H
+#define RAMWATCH_H
+
+#include "types.h"
+
+#include <stdio.h>
+
+// Frame-to-frame RAM diffing. ramwatch_scan compares MEM1 against the copy
+// from the previous scan 64 bytes at a time, with AVX2 where available, and
+// only touches the copy where something changed. Changed bytes come out as a
+// sorted list of ranges; ranges less than RAMWATCH_MERGE_GAP apart are merged
+// to keep the list compact. Watchpoints are checked before the copy is
+// updated so a hit can report the old and new value.
+
+#define RAMWATCH_MERGE_GAP 8
+#define RAMWATCH_MAX_WATCHPOINTS 16
+
+typedef struct RamRange {
+    U32 address;
+    U32 size;
+} RamRange;
+
+typedef struct Watchpoint {
+    U32 address;
+    U32 size;    // 1 to 4 bytes
+    U32 old;     // big endian values at the last hit
+    U32 new;
+    bool hit;
+} Watchpoint;
+
+typedef struct RamWatch {
+    const U8 *mem;
+    size_t size;
+    U32 base;               // guest address of mem[0]
+    U8 *prev;
+
+    RamRange *ranges;
+    size_t range_count;
+    size_t range_capacity;
+
+    Watchpoint watchpoints[RAMWATCH_MAX_WATCHPOINTS];
+    unsigned watchpoint_count;
+
+    U64 scans;
+    U64 changed_bytes;
+    double scan_time;
+} RamWatch;
+
+bool ramwatch_init(RamWatch *w, const U8 *mem, size_t size, U32 base);
+void ramwatch_deinit(RamWatch *w);
+
+bool ramwatch_add(RamWatch *w, U32 address, U32 size);
+
+// Diffs against the last scan and fills w->ranges. Returns whether any
+// watchpoint was hit; the hit ones have hit set until the next scan.
+bool ramwatch_scan(RamWatch *w);
+
+// Writes the current change list as one line.
+void ramwatch_log(const RamWatch *w, FILE *f, U64 frame);
+
+#endif
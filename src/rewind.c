@@ -0,0 +1,150 @@
+#include "rewind.h"
+#include "delta.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define REWIND_MAX_ENTRIES 65536
+
+static RewindEntry *entry_at(Rewind *r, size_t i) {
+    return &r->entries[(r->entry_first + i) % r->entry_capacity];
+}
+
+static RewindEntry *newest(Rewind *r) {
+    return entry_at(r, r->entry_count - 1);
+}
+
+bool rewind_init(Rewind *r, core_functions_t *core, size_t arena_size, unsigned interval, unsigned keyframe_every) {
+    memset(r, 0, sizeof(*r));
+    r->core = core;
+    r->state_size = core->core_serialize_size();
+    r->interval = interval ? interval : 1;
+    r->keyframe_every = keyframe_every ? keyframe_every : 1;
+    if (r->state_size == 0 || arena_size < r->state_size) return false;
+
+    r->arena_size = arena_size;
+    r->arena = malloc(arena_size);
+    r->entry_capacity = REWIND_MAX_ENTRIES;
+    r->entries = calloc(r->entry_capacity, sizeof(RewindEntry));
+    r->state = malloc(r->state_size);
+    r->encoded = malloc(delta_bound(r->state_size));
+    if (r->arena == NULL || r->entries == NULL || r->state == NULL || r->encoded == NULL) {
+        rewind_deinit(r);
+        return false;
+    }
+    return true;
+}
+
+void rewind_deinit(Rewind *r) {
+    free(r->arena);
+    free(r->entries);
+    free(r->state);
+    free(r->encoded);
+    memset(r, 0, sizeof(*r));
+}
+
+// Drops the oldest keyframe and the deltas that depend on it.
+static void evict_group(Rewind *r) {
+    do {
+        r->entry_first = (r->entry_first + 1) % r->entry_capacity;
+        r->entry_count--;
+        r->evicted++;
+    } while (r->entry_count > 0 && !entry_at(r, 0)->keyframe);
+    if (r->entry_count == 0) r->since_keyframe = 0;
+}
+
+// Finds room for size contiguous bytes, evicting old groups as needed.
+static size_t arena_alloc(Rewind *r, size_t size) {
+    for (;;) {
+        if (r->entry_count == 0) {
+            r->head = 0;
+            return 0;
+        }
+        size_t tail = entry_at(r, 0)->offset;
+        if (r->head > tail) {
+            if (r->arena_size - r->head >= size) return r->head;
+            if (tail >= size) return 0;
+        } else if (tail - r->head >= size) {
+            return r->head;
+        }
+        evict_group(r);
+    }
+}
+
+bool rewind_push(Rewind *r) {
+    r->frame++;
+    if (r->frame % r->interval != 0) return true;
+    if (!r->core->core_serialize(r->state, r->state_size)) return false;
+
+    if (r->entry_count == r->entry_capacity) evict_group(r);
+
+    bool keyframe = r->entry_count == 0 || r->since_keyframe >= r->keyframe_every;
+    const U8 *payload = r->state;
+    size_t size = r->state_size;
+    size_t key_offset = 0;
+
+    if (!keyframe) {
+        key_offset = newest(r)->key_offset;
+        size_t encoded = delta_encode(r->encoded, r->state_size / 2, r->state, r->arena + key_offset, r->state_size);
+        if (encoded != 0) {
+            payload = r->encoded;
+            size = encoded;
+        } else {
+            // Diverged too far from the keyframe to be worth a delta.
+            keyframe = true;
+        }
+    }
+
+    size_t offset = arena_alloc(r, size);
+    if (!keyframe && r->entry_count == 0) {
+        // Making room evicted the keyframe this delta was against.
+        keyframe = true;
+        payload = r->state;
+        size = r->state_size;
+        offset = arena_alloc(r, size);
+    }
+
+    memcpy(r->arena + offset, payload, size);
+    *entry_at(r, r->entry_count) = (RewindEntry) {
+        .offset = offset,
+        .size = size,
+        .key_offset = keyframe ? offset : key_offset,
+        .frame = r->frame,
+        .keyframe = keyframe,
+    };
+    r->entry_count++;
+    r->head = offset + size;
+    r->since_keyframe = keyframe ? 1 : r->since_keyframe + 1;
+    r->pushed++;
+    return true;
+}
+
+bool rewind_step_back(Rewind *r) {
+    if (r->entry_count == 0) return false;
+
+    RewindEntry e = *newest(r);
+    bool ok;
+    if (e.keyframe) {
+        ok = r->core->core_unserialize(r->arena + e.offset, r->state_size);
+    } else {
+        ok = delta_decode(r->state, r->arena + e.key_offset, r->state_size, r->arena + e.offset, e.size)
+            && r->core->core_unserialize(r->state, r->state_size);
+    }
+
+    r->entry_count--;
+    r->head = r->entry_count ? e.offset : 0;
+    r->frame = e.frame;
+
+    r->since_keyframe = 0;
+    for (size_t i = r->entry_count; i-- > 0;) {
+        r->since_keyframe++;
+        if (entry_at(r, i)->keyframe) break;
+    }
+    return ok;
+}
+
+size_t rewind_used(const Rewind *r) {
+    if (r->entry_count == 0) return 0;
+    size_t tail = r->entries[r->entry_first].offset;
+    return r->head > tail ? r->head - tail : r->arena_size - tail + r->head;
+}
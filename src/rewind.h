@@ -0,0 +1,59 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "core.h"
+#include "types.h"
+
+// Savestate history for rewinding. Every interval frames the core is
+// serialized; every keyframe_every-th snapshot is kept whole and the rest are
+// stored as a delta against the keyframe before them (delta.h). Everything
+// lives in one arena allocated up front from core_serialize_size, used as a
+// FIFO ring: when it is full, the oldest keyframe is dropped together with the
+// deltas that depend on it.
+
+typedef struct RewindEntry {
+    size_t offset;     // into arena
+    size_t size;
+    size_t key_offset; // keyframe this entry decodes against, itself for keyframes
+    U64 frame;
+    bool keyframe;
+} RewindEntry;
+
+typedef struct Rewind {
+    core_functions_t *core;
+    size_t state_size;
+    unsigned interval;
+    unsigned keyframe_every;
+
+    U8 *arena;
+    size_t arena_size;
+    size_t head;
+
+    RewindEntry *entries;
+    size_t entry_capacity;
+    size_t entry_first;
+    size_t entry_count;
+    unsigned since_keyframe;
+
+    U8 *state;   // serialize target and decode output
+    U8 *encoded; // delta_bound(state_size) scratch
+    U64 frame;
+
+    U64 pushed;
+    U64 evicted;
+} Rewind;
+
+bool rewind_init(Rewind *r, core_functions_t *core, size_t arena_size, unsigned interval, unsigned keyframe_every);
+void rewind_deinit(Rewind *r);
+
+// Call after every core_run; snapshots on every interval-th call.
+bool rewind_push(Rewind *r);
+
+// Restores the newest snapshot and drops it. Returns false when the history
+// is empty.
+bool rewind_step_back(Rewind *r);
+
+// Bytes of the arena currently holding snapshots.
+size_t rewind_used(const Rewind *r);
+
+#endif
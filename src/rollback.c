@@ -0,0 +1,185 @@
+#include "rollback.h"
+#include "clock.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static RollbackSlot *slot(Rollback *r, U32 frame) {
+    return &r->slots[frame % ROLLBACK_WINDOW];
+}
+
+static RollbackRemote *remote(Rollback *r, U32 frame) {
+    return &r->remote[frame % ROLLBACK_REMOTE_FRAMES];
+}
+
+// Remote input for a frame before r->confirmed.
+static const InputPort *confirmed_input(Rollback *r, U32 frame) {
+    return &remote(r, frame)->input;
+}
+
+// Running further would overwrite the state before the oldest unconfirmed frame.
+static bool window_full(const Rollback *r) {
+    return r->frame >= r->confirmed + ROLLBACK_WINDOW;
+}
+
+static U8 *state(Rollback *r, U32 frame) {
+    return r->states + (size_t)(frame % ROLLBACK_WINDOW) * r->state_size;
+}
+
+static bool port_equal(const InputPort *a, const InputPort *b) {
+    return a->buttons == b->buttons
+        && memcmp(a->axes, b->axes, sizeof(a->axes)) == 0
+        && memcmp(a->triggers, b->triggers, sizeof(a->triggers)) == 0;
+}
+
+bool rollback_init(Rollback *r, core_functions_t *core, RollbackTransport transport,
+    unsigned local_port, unsigned remote_port, int *av_enable
+) {
+    memset(r, 0, sizeof(*r));
+    r->core = core;
+    r->transport = transport;
+    r->local_port = local_port;
+    r->remote_port = remote_port;
+    r->av_enable = av_enable;
+    r->state_size = core->core_serialize_size();
+    if (r->state_size == 0 || local_port >= INPUT_PORTS || remote_port >= INPUT_PORTS) return false;
+    r->states = malloc(r->state_size * ROLLBACK_WINDOW);
+    return r->states != NULL;
+}
+
+void rollback_deinit(Rollback *r) {
+    free(r->states);
+    memset(r, 0, sizeof(*r));
+}
+
+// Saves the state before frame, then runs it.
+static bool run_frame(Rollback *r, U32 frame) {
+    double t0 = time_now();
+    bool ok = r->core->core_serialize(state(r, frame), r->state_size);
+    r->stats.saves++;
+    r->stats.save_time += time_now() - t0;
+    if (!ok) return false;
+
+    input_publish(&slot(r, frame)->ran);
+    r->core->core_run();
+    return true;
+}
+
+// Drains the transport and advances the confirmed frame. Returns the first
+// frame that ran on a wrong prediction, or r->frame if there was none.
+static U32 receive(Rollback *r) {
+    // Inputs are kept from the oldest frame that still needs one: the oldest
+    // unconfirmed frame, or the next to run if the peer is ahead. Frames
+    // past the ring wait in r->held and stop the drain. Anything stored
+    // overwrites only frames before that oldest frame, so the inputs that
+    // the frames still to run or be resimulated read stay in place.
+    U32 oldest = r->confirmed < r->frame ? r->confirmed : r->frame;
+    for (;;) {
+        RollbackRemote in = r->held;
+        r->held.known = false;
+        if (!in.known) {
+            if (!r->transport.recv(r->transport.ctx, &in.frame, &in.input)) break;
+            in.known = true;
+        }
+        if (in.frame < r->confirmed) continue; // duplicate
+        if (in.frame - oldest >= ROLLBACK_REMOTE_FRAMES) {
+            r->held = in;
+            break;
+        }
+        *remote(r, in.frame) = in;
+    }
+
+    U32 mispredicted = r->frame;
+    for (;;) {
+        RollbackRemote *in = remote(r, r->confirmed);
+        if (!in->known || in->frame != r->confirmed) break;
+        if (r->confirmed < r->frame && mispredicted == r->frame
+            && !port_equal(&slot(r, r->confirmed)->ran.ports[r->remote_port], &in->input))
+            mispredicted = r->confirmed;
+        r->prediction = in->input;
+        r->confirmed++;
+    }
+    return mispredicted;
+}
+
+// Restores the state before frame `from` and runs every frame up to the
+// present again with corrected inputs and no output.
+static bool resimulate(Rollback *r, U32 from) {
+    double t0 = time_now();
+    bool ok = r->core->core_unserialize(state(r, from), r->state_size);
+    double t1 = time_now();
+    r->stats.load_time += t1 - t0;
+    if (!ok) return false;
+
+    int host_av = *r->av_enable;
+    *r->av_enable = 0;
+    for (U32 f = from; ok && f < r->frame; ++f) {
+        RollbackSlot *s = slot(r, f);
+        // Frames still unconfirmed are predicted again from the newest input.
+        s->ran.ports[r->remote_port] = f < r->confirmed ? *confirmed_input(r, f) : r->prediction;
+        if (f == from) {
+            input_publish(&s->ran);
+            r->core->core_run();
+        } else {
+            ok = run_frame(r, f);
+        }
+    }
+    *r->av_enable = host_av;
+
+    U32 depth = r->frame - from;
+    r->stats.rollbacks++;
+    r->stats.resimulated_frames += depth;
+    if (depth > r->stats.max_depth) r->stats.max_depth = depth;
+    r->stats.resimulate_time += time_now() - t1;
+    return ok;
+}
+
+RollbackStatus rollback_run(Rollback *r, const InputSnapshot *local) {
+    U32 mispredicted;
+    if (window_full(r)) {
+        // Wait for the peer.
+        mispredicted = receive(r);
+        if (mispredicted != r->frame && !resimulate(r, mispredicted)) return ROLLBACK_FAILED;
+        if (window_full(r)) {
+            r->stats.stalls++;
+            return ROLLBACK_STALLED;
+        }
+    }
+
+    RollbackSlot *s = slot(r, r->frame);
+    s->ran = *local;
+    r->transport.send(r->transport.ctx, r->frame, &local->ports[r->local_port]);
+
+    mispredicted = receive(r);
+    if (mispredicted != r->frame && !resimulate(r, mispredicted)) return ROLLBACK_FAILED;
+
+    s->ran.ports[r->remote_port] = r->frame < r->confirmed ? *confirmed_input(r, r->frame) : r->prediction;
+    if (!run_frame(r, r->frame)) return ROLLBACK_FAILED;
+    r->frame++;
+    r->stats.frames++;
+    return ROLLBACK_RAN;
+}
+
+// LOOPBACK #####################################################################
+
+static void loopback_send(void *ctx, U32 frame, const InputPort *input) {
+    Loopback *l = ctx;
+    l->queue[frame % ROLLBACK_WINDOW] = *input;
+    l->newest = frame;
+    l->sent = true;
+}
+
+static bool loopback_recv(void *ctx, U32 *frame, InputPort *input) {
+    Loopback *l = ctx;
+    if (!l->sent || l->next + l->latency > l->newest) return false;
+    *frame = l->next;
+    *input = l->queue[l->next % ROLLBACK_WINDOW];
+    l->next++;
+    return true;
+}
+
+RollbackTransport loopback_transport(Loopback *l, unsigned latency) {
+    memset(l, 0, sizeof(*l));
+    l->latency = latency;
+    return (RollbackTransport) { .ctx = l, .send = loopback_send, .recv = loopback_recv };
+}
@@ -0,0 +1,106 @@
+#ifndef ROLLBACK_H
+#define ROLLBACK_H
+
+#include "core.h"
+#include "input.h"
+#include "types.h"
+
+// Rollback runs the core ahead of a remote player's input. Frames whose
+// remote input hasn't arrived run on a prediction (the last confirmed remote
+// input). When a confirmed input differs from what a frame ran with, the core
+// is restored to the state before that frame and every frame since is run
+// again with audio and video disabled through the host's
+// RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE flags.
+//
+// The state before each of the last ROLLBACK_WINDOW frames is kept in a pool
+// allocated once at init and reused in place.
+//
+// Remote inputs are held from the oldest frame that still needs one up to
+// ROLLBACK_REMOTE_FRAMES ahead of it, enough for a peer keeping the same
+// window to be a full window ahead. An input further ahead than that is kept
+// back, and the transport is not drained past it, until the local frames
+// catch up.
+
+#define ROLLBACK_WINDOW 32
+#define ROLLBACK_REMOTE_FRAMES (2 * ROLLBACK_WINDOW)
+
+typedef struct RollbackTransport {
+    void *ctx;
+    // Sends the local player's input for a frame to the peer.
+    void (*send)(void *ctx, U32 frame, const InputPort *input);
+    // Receives one of the peer's inputs, false when none is waiting.
+    bool (*recv)(void *ctx, U32 *frame, InputPort *input);
+} RollbackTransport;
+
+typedef enum RollbackStatus {
+    ROLLBACK_RAN,
+    ROLLBACK_STALLED,        // the peer is a window behind, run the frame again later
+    ROLLBACK_FAILED,         // the core couldn't save or load a state
+} RollbackStatus;
+
+typedef struct RollbackStats {
+    U64 frames;
+    U64 stalls;              // frames not run because the peer fell a window behind
+    U64 rollbacks;
+    U64 resimulated_frames;
+    U32 max_depth;
+    U64 saves;
+    double save_time;
+    double load_time;
+    double resimulate_time;
+} RollbackStats;
+
+typedef struct RollbackSlot {
+    InputSnapshot ran;       // input the frame last ran with
+} RollbackSlot;
+
+typedef struct RollbackRemote {
+    InputPort input;
+    U32 frame;
+    bool known;
+} RollbackRemote;
+
+typedef struct Rollback {
+    core_functions_t *core;
+    int *av_enable;
+    RollbackTransport transport;
+    unsigned local_port;
+    unsigned remote_port;
+
+    U8 *states;              // slot frame % ROLLBACK_WINDOW holds the state before frame
+    size_t state_size;
+    RollbackSlot slots[ROLLBACK_WINDOW];
+    RollbackRemote remote[ROLLBACK_REMOTE_FRAMES]; // frame % ROLLBACK_REMOTE_FRAMES
+    RollbackRemote held;     // received too far ahead to store yet
+    InputPort prediction;    // newest confirmed remote input
+
+    U32 frame;               // next frame to run
+    U32 confirmed;           // remote input is known for every frame before this,
+                             // which may be ahead of frame
+    RollbackStats stats;
+} Rollback;
+
+bool rollback_init(Rollback *r, core_functions_t *core, RollbackTransport transport,
+    unsigned local_port, unsigned remote_port, int *av_enable);
+void rollback_deinit(Rollback *r);
+
+// Runs one host frame with the given local input in place of core_run.
+RollbackStatus rollback_run(Rollback *r, const InputSnapshot *local);
+
+// LOOPBACK #####################################################################
+
+// In-process stand-in for a network peer. It mirrors the local player's input
+// back as its own, delivered `latency` frames late, so prediction and
+// rollback can be exercised without a network.
+typedef struct Loopback {
+    InputPort queue[ROLLBACK_WINDOW];
+    U32 latency;
+    U32 newest;
+    U32 next;
+    bool sent;
+} Loopback;
+
+// latency must be below ROLLBACK_WINDOW.
+RollbackTransport loopback_transport(Loopback *l, unsigned latency);
+
+#endif
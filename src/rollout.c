@@ -0,0 +1,391 @@
+// for sched_setaffinity
+#define _GNU_SOURCE
+#include "rollout.h"
+#include "chunkstore.h"
+#include "clock.h"
+#include "env.h"
+#include "memmap.h"
+#include "threads.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#define ROLLOUT_ALIGN 64
+
+// How often a waiting scheduler checks for workers that died.
+#define ROLLOUT_REAP_MS 100
+
+// In RolloutShared.running for a worker between jobs.
+#define ROLLOUT_IDLE UINT32_MAX
+
+typedef struct RolloutShared {
+    pthread_mutex_t lock;
+    pthread_cond_t pending_cond;
+    pthread_cond_t done_cond;
+    bool quit;
+    U32 pending_first;
+    U32 pending_count;
+    U32 done_first;
+    U32 done_count;
+} RolloutShared;
+// Followed by U32 running[workers], the slot each worker is running or
+// ROLLOUT_IDLE, so the job of a worker that dies can be failed.
+
+// Followed by the job's actions and then its result.
+typedef struct RolloutSlot {
+    U64 tag;
+    U64 state;
+    U32 action_count;
+    U32 worker;
+    bool ok;
+    double run_time;
+} RolloutSlot;
+
+struct Rollouts {
+    RolloutConfig config;
+    Envs *envs;
+    ChunkStore store;
+
+    U8 *shared;
+    size_t shared_size;
+    U32 *pending;            // rings of slot indices, in shared
+    U32 *done;
+    U32 *running;            // by worker, in shared
+    U8 *slots;
+    size_t slot_size;
+    U32 slot_count;
+
+    U32 *free_slots;         // scheduler side only
+    U32 free_count;
+    U32 in_flight;
+
+    pid_t *pids;             // 0 once reaped
+    unsigned workers;
+    unsigned alive;
+};
+
+static size_t align_up(size_t n, size_t align) {
+    return (n + align - 1) & ~(align - 1);
+}
+
+static RolloutShared *shared_header(const Rollouts *r) {
+    return (RolloutShared *)r->shared;
+}
+
+static RolloutSlot *slot_at(const Rollouts *r, U32 i) {
+    return (RolloutSlot *)(r->slots + r->slot_size * i);
+}
+
+static InputSnapshot *slot_actions(RolloutSlot *slot) {
+    return (InputSnapshot *)((U8 *)slot + align_up(sizeof(RolloutSlot), ROLLOUT_ALIGN));
+}
+
+static U8 *slot_result(const Rollouts *r, RolloutSlot *slot) {
+    return (U8 *)(slot_actions(slot) + r->config.max_actions);
+}
+
+// The mutex is robust: if a worker dies holding it, the next locker takes it
+// over instead of waiting forever.
+static void lock_shared(RolloutShared *sh) {
+    if (pthread_mutex_lock(&sh->lock) == EOWNERDEAD) pthread_mutex_consistent(&sh->lock);
+}
+
+static int wait_shared(pthread_cond_t *cond, RolloutShared *sh, const struct timespec *until) {
+    int err = until != NULL ? pthread_cond_timedwait(cond, &sh->lock, until) : pthread_cond_wait(cond, &sh->lock);
+    if (err == EOWNERDEAD) pthread_mutex_consistent(&sh->lock);
+    return err;
+}
+
+static void push_done(Rollouts *r, U32 i) {
+    RolloutShared *sh = shared_header(r);
+    r->done[(sh->done_first + sh->done_count) % r->slot_count] = i;
+    sh->done_count++;
+    pthread_cond_signal(&sh->done_cond);
+}
+
+// WORKER #######################################################################
+
+static bool run_job(Rollouts *r, RolloutSlot *slot) {
+    bool loaded = env_load_state(r->envs, 0, &r->store, slot->state);
+    // The state may have been stored after this worker was forked.
+    if (!loaded && chunkstore_refresh(&r->store))
+        loaded = env_load_state(r->envs, 0, &r->store, slot->state);
+    if (!loaded) return false;
+
+    const InputSnapshot *actions = slot_actions(slot);
+    for (U32 i = 0; i < slot->action_count; ++i)
+        env_step(r->envs, &actions[i], 1);
+
+    U8 *result = slot_result(r, slot);
+    if (r->config.result_size == 0) return true;
+    return memmap_read(env_memory(r->envs, 0), r->config.result_address, result, r->config.result_size);
+}
+
+static void worker_main(Rollouts *r, unsigned index, int cpu, pid_t scheduler) {
+    // Don't outlive the scheduler, even if it is killed.
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != scheduler) _exit(1);
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET((size_t)cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+
+    RolloutShared *sh = shared_header(r);
+    lock_shared(sh);
+    while (true) {
+        while (sh->pending_count == 0 && !sh->quit)
+            wait_shared(&sh->pending_cond, sh, NULL);
+        if (sh->quit) break;
+        U32 i = r->pending[sh->pending_first];
+        r->running[index] = i;
+        sh->pending_first = (sh->pending_first + 1) % r->slot_count;
+        sh->pending_count--;
+        pthread_mutex_unlock(&sh->lock);
+
+        RolloutSlot *slot = slot_at(r, i);
+        double start = time_now();
+        slot->ok = run_job(r, slot);
+        slot->worker = index;
+        slot->run_time = time_now() - start;
+
+        // Idle first: a worker killed in between must not have its finished
+        // job failed and pushed a second time.
+        lock_shared(sh);
+        r->running[index] = ROLLOUT_IDLE;
+        push_done(r, i);
+    }
+    pthread_mutex_unlock(&sh->lock);
+    _exit(0);
+}
+
+// SCHEDULER ####################################################################
+
+static bool init_shared(Rollouts *r) {
+    r->slot_size = align_up(align_up(sizeof(RolloutSlot), ROLLOUT_ALIGN)
+        + r->config.max_actions * sizeof(InputSnapshot) + r->config.result_size, ROLLOUT_ALIGN);
+    size_t rings = align_up(2 * r->slot_count * sizeof(U32), ROLLOUT_ALIGN);
+    size_t header = align_up(sizeof(RolloutShared) + r->workers * sizeof(U32), ROLLOUT_ALIGN);
+    r->shared_size = header + rings + r->slot_size * r->slot_count;
+    U8 *shared = mmap(NULL, r->shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) return false;
+    r->shared = shared;
+    r->running = (U32 *)(shared + sizeof(RolloutShared));
+    for (unsigned w = 0; w < r->workers; ++w) r->running[w] = ROLLOUT_IDLE;
+    r->pending = (U32 *)(shared + header);
+    r->done = r->pending + r->slot_count;
+    r->slots = shared + header + rings;
+
+    RolloutShared *sh = shared_header(r);
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&sh->lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sh->pending_cond, &cond_attr);
+    pthread_cond_init(&sh->done_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    r->free_slots = malloc(r->slot_count * sizeof(U32));
+    if (r->free_slots == NULL) return false;
+    for (U32 i = 0; i < r->slot_count; ++i) r->free_slots[i] = r->slot_count - 1 - i;
+    r->free_count = r->slot_count;
+    return true;
+}
+
+static bool start_workers(Rollouts *r) {
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE];
+    unsigned cpu_count = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &allowed)) cpus[cpu_count++] = (int)cpu;
+    }
+    r->pids = calloc(r->workers, sizeof(pid_t));
+    if (r->pids == NULL) return false;
+
+    unsigned threads = thread_count();
+    if (threads > 1) {
+        fprintf(stderr, "the core has %u threads running, a forked worker would only get one of them;"
+            " rollouts need a core that runs on the calling thread only\n", threads);
+        return false;
+    }
+
+    // Output buffered before the fork would be written again by every worker.
+    fflush(NULL);
+    pid_t scheduler = getpid();
+    for (unsigned i = 0; i < r->workers; ++i) {
+        int cpu = cpu_count ? cpus[i % cpu_count] : -1;
+        pid_t pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "could not fork worker %u: %s\n", i, strerror(errno));
+            return false;
+        }
+        if (pid == 0) worker_main(r, i, cpu, scheduler);
+        r->pids[i] = pid;
+        r->alive++;
+    }
+    return true;
+}
+
+// Called with the lock held. The job a dead worker was running comes back
+// through the done ring as failed.
+static void reap_workers(Rollouts *r) {
+    for (unsigned i = 0; i < r->workers; ++i) {
+        if (r->pids[i] == 0 || waitpid(r->pids[i], NULL, WNOHANG) != r->pids[i]) continue;
+        fprintf(stderr, "rollout worker %u exited\n", i);
+        r->pids[i] = 0;
+        r->alive--;
+
+        U32 job = r->running[i];
+        if (job == ROLLOUT_IDLE) continue;
+        r->running[i] = ROLLOUT_IDLE;
+        RolloutSlot *slot = slot_at(r, job);
+        slot->ok = false;
+        slot->worker = i;
+        slot->run_time = 0.0;
+        push_done(r, job);
+    }
+}
+
+Rollouts *rollout_create(const RolloutConfig *config) {
+    Rollouts *r = calloc(1, sizeof(Rollouts));
+    if (r == NULL) return NULL;
+    r->config = *config;
+    r->config.frame_skip = config->frame_skip ? config->frame_skip : 1;
+    if (!chunkstore_open(&r->store, config->store_dir)) {
+        fprintf(stderr, "could not open chunk store %s\n", config->store_dir);
+        free(r);
+        return NULL;
+    }
+
+    EnvConfig env_config = {
+        .core_path = config->core_path,
+        .iso_path = config->iso_path,
+        .system_dir = config->system_dir,
+        .save_dir = config->save_dir,
+        .count = 1,
+        .frame_skip = r->config.frame_skip,
+    };
+    r->envs = env_create(&env_config);
+    if (r->envs == NULL) {
+        rollout_destroy(r);
+        return NULL;
+    }
+
+    unsigned workers = config->workers;
+    if (workers == 0) {
+        cpu_set_t allowed;
+        workers = sched_getaffinity(0, sizeof(allowed), &allowed) == 0 ? (unsigned)CPU_COUNT(&allowed) : 1;
+    }
+    r->workers = workers;
+    r->slot_count = config->slots ? config->slots : workers * 2;
+    if (!init_shared(r) || !start_workers(r)) {
+        fprintf(stderr, "could not start rollout workers\n");
+        rollout_destroy(r);
+        return NULL;
+    }
+    return r;
+}
+
+void rollout_destroy(Rollouts *r) {
+    if (r == NULL) return;
+    if (r->shared != NULL) {
+        RolloutShared *sh = shared_header(r);
+        lock_shared(sh);
+        sh->quit = true;
+        pthread_cond_broadcast(&sh->pending_cond);
+        pthread_mutex_unlock(&sh->lock);
+    }
+    for (unsigned i = 0; r->pids != NULL && i < r->workers; ++i)
+        if (r->pids[i] != 0) waitpid(r->pids[i], NULL, 0);
+    if (r->shared != NULL) munmap(r->shared, r->shared_size);
+    env_destroy(r->envs);
+    chunkstore_close(&r->store);
+    free(r->free_slots);
+    free(r->pids);
+    free(r);
+}
+
+unsigned rollout_workers(const Rollouts *r) {
+    return r->workers;
+}
+
+bool rollout_submit(Rollouts *r, U64 tag, U64 state, const InputSnapshot actions[], U32 count) {
+    if (count > r->config.max_actions || r->free_count == 0) return false;
+    U32 i = r->free_slots[--r->free_count];
+    RolloutSlot *slot = slot_at(r, i);
+    slot->tag = tag;
+    slot->state = state;
+    slot->action_count = count;
+    memcpy(slot_actions(slot), actions, count * sizeof(InputSnapshot));
+
+    RolloutShared *sh = shared_header(r);
+    lock_shared(sh);
+    r->pending[(sh->pending_first + sh->pending_count++) % r->slot_count] = i;
+    pthread_cond_signal(&sh->pending_cond);
+    pthread_mutex_unlock(&sh->lock);
+    r->in_flight++;
+    return true;
+}
+
+bool rollout_collect(Rollouts *r, RolloutResult *result, U8 *data, int timeout_ms) {
+    if (r->in_flight == 0) return false;
+    double deadline = time_now() + timeout_ms / 1e3;
+
+    RolloutShared *sh = shared_header(r);
+    lock_shared(sh);
+    while (sh->done_count == 0 && r->alive != 0) {
+        double wait = ROLLOUT_REAP_MS / 1e3;
+        if (timeout_ms >= 0 && deadline - time_now() < wait) wait = deadline - time_now();
+        if (wait <= 0.0) break;
+
+        struct timespec until;
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        long nsec = until.tv_nsec + (long)(wait * 1e9);
+        until.tv_sec += nsec / 1000000000;
+        until.tv_nsec = nsec % 1000000000;
+        if (wait_shared(&sh->done_cond, sh, &until) == ETIMEDOUT)
+            reap_workers(r);
+    }
+    // Workers that died since the last wait.
+    if (sh->done_count == 0) reap_workers(r);
+    if (sh->done_count == 0) {
+        pthread_mutex_unlock(&sh->lock);
+        return false;
+    }
+    U32 i = r->done[sh->done_first];
+    sh->done_first = (sh->done_first + 1) % r->slot_count;
+    sh->done_count--;
+    pthread_mutex_unlock(&sh->lock);
+
+    RolloutSlot *slot = slot_at(r, i);
+    *result = (RolloutResult) {
+        .tag = slot->tag,
+        .ok = slot->ok,
+        .worker = slot->worker,
+        .run_time = slot->run_time,
+    };
+    if (data != NULL) memcpy(data, slot_result(r, slot), r->config.result_size);
+    r->free_slots[r->free_count++] = i;
+    r->in_flight--;
+    return true;
+}
@@ -0,0 +1,65 @@
+#ifndef ROLLOUT_H
+#define ROLLOUT_H
+
+#include "input.h"
+#include "types.h"
+
+// Rollouts spread over worker processes. The scheduler boots one environment
+// (env.h) and then forks the workers from it, so every worker starts with the
+// game already loaded and shares its memory copy-on-write instead of booting
+// its own. Each worker is pinned to one CPU of the scheduler's affinity mask.
+//
+// A job is a state from a chunk store (chunkstore.h) and the actions to step
+// from it; its result is a span of guest memory read once the last action has
+// run. Jobs and results pass through one shared anonymous mapping: a fixed
+// set of slots, each holding one job's actions and then its result, and two
+// rings of slot indices, pending and done, guarded by a process-shared mutex.
+//
+// Forking only carries over the calling thread, so the core must not have
+// threads of its own running when the scheduler forks; rollout_create fails if
+// it does. This rules out libdolphin: it starts its CPU and GPU threads while
+// loading the game, and nothing here asks it for single-threaded options. The
+// pool only runs cores that do all their work inside retro_run. A job whose
+// worker dies is collected as failed; the other workers carry on.
+
+typedef struct RolloutConfig {
+    const char *core_path;
+    const char *iso_path;
+    const char *system_dir;  // may be NULL
+    const char *save_dir;    // may be NULL
+    const char *store_dir;   // chunk store the jobs' states are in
+    unsigned workers;        // 0 for one per CPU the scheduler may run on
+    unsigned slots;          // jobs in flight, 0 for twice the workers
+    unsigned max_actions;    // longest action sequence of a job
+    unsigned frame_skip;     // core frames per action
+    U32 result_address;      // guest memory copied into each result
+    U32 result_size;
+} RolloutConfig;
+
+typedef struct RolloutResult {
+    U64 tag;                 // as given to rollout_submit
+    bool ok;                 // false if the state couldn't be loaded or the worker died
+    unsigned worker;
+    double run_time;         // loading the state and stepping, in the worker
+} RolloutResult;
+
+typedef struct Rollouts Rollouts;
+
+// Returns NULL on failure, after printing why.
+Rollouts *rollout_create(const RolloutConfig *config);
+
+// Stops and reaps the workers.
+void rollout_destroy(Rollouts *r);
+
+unsigned rollout_workers(const Rollouts *r);
+
+// Queues a job. Returns false if count is over max_actions or every slot is
+// in use, in which case collect a result first.
+bool rollout_submit(Rollouts *r, U64 tag, U64 state, const InputSnapshot actions[], U32 count);
+
+// Waits up to timeout_ms (negative for no limit) for a finished job and
+// copies its result, with result_size bytes of guest memory into data.
+// Returns false on timeout, when nothing is in flight or every worker has died.
+bool rollout_collect(Rollouts *r, RolloutResult *result, U8 *data, int timeout_ms);
+
+#endif
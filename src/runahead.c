@@ -0,0 +1,64 @@
+#include "runahead.h"
+#include "clock.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool runahead_init(Runahead *r, core_functions_t *core, core_functions_t *secondary, unsigned frames, int *av_enable) {
+    memset(r, 0, sizeof(*r));
+    r->core = core;
+    r->secondary = secondary;
+    r->frames = frames;
+    r->av_enable = av_enable;
+    r->state_size = core->core_serialize_size();
+    if (r->state_size == 0 || frames == 0) return false;
+    r->state = malloc(r->state_size);
+    return r->state != NULL;
+}
+
+void runahead_deinit(Runahead *r) {
+    free(r->state);
+    memset(r, 0, sizeof(*r));
+}
+
+bool runahead_run(Runahead *r) {
+    // Whatever the host had enabled is what the presented frame gets.
+    int host_av = *r->av_enable;
+    double t0 = time_now();
+
+    *r->av_enable = host_av & RETRO_AV_ENABLE_AUDIO;
+    r->core->core_run();
+    double t1 = time_now();
+
+    bool ok = r->core->core_serialize(r->state, r->state_size);
+    double t2 = time_now();
+
+    core_functions_t *ahead = r->core;
+    double t3 = t2;
+    if (ok && r->secondary != NULL) {
+        ok = r->secondary->core_unserialize(r->state, r->state_size);
+        ahead = r->secondary;
+        t3 = time_now();
+    }
+
+    for (unsigned i = 0; ok && i < r->frames; ++i) {
+        bool last = i + 1 == r->frames;
+        *r->av_enable = last ? host_av & RETRO_AV_ENABLE_VIDEO : 0;
+        ahead->core_run();
+    }
+    double t4 = time_now();
+
+    if (ok && r->secondary == NULL)
+        ok = r->core->core_unserialize(r->state, r->state_size);
+    double t5 = time_now();
+
+    *r->av_enable = host_av;
+
+    r->stats.runs++;
+    r->stats.ahead_frames += r->frames;
+    r->stats.real_time += t1 - t0;
+    r->stats.serialize_time += t2 - t1;
+    r->stats.unserialize_time += (t3 - t2) + (t5 - t4);
+    r->stats.ahead_time += t4 - t3;
+    return ok;
+}
@@ -0,0 +1,46 @@
+#ifndef RUNAHEAD_H
+#define RUNAHEAD_H
+
+#include "core.h"
+#include "types.h"
+
+// Run-ahead hides frames of the game's own input lag. Each host frame runs
+// the real frame, then `frames` more with the same input, presents only the
+// last of those, and returns to the real frame's state.
+//
+// With one instance the core is serialized after the real frame and
+// unserialized after the ahead frames. With a secondary instance the primary
+// only ever runs real frames (so its audio is never interrupted) and the
+// secondary is loaded from the primary's state every frame to run ahead.
+//
+// Audio and video are switched through the host's
+// RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE flags, which the host's callbacks
+// must honor.
+
+typedef struct RunaheadStats {
+    U64 runs;
+    U64 ahead_frames;
+    double real_time;        // running real frames
+    double serialize_time;
+    double unserialize_time;
+    double ahead_time;       // running ahead frames
+} RunaheadStats;
+
+typedef struct Runahead {
+    core_functions_t *core;
+    core_functions_t *secondary;
+    unsigned frames;
+    int *av_enable;
+    U8 *state;
+    size_t state_size;
+    RunaheadStats stats;
+} Runahead;
+
+// secondary may be NULL. It must already have the same game loaded.
+bool runahead_init(Runahead *r, core_functions_t *core, core_functions_t *secondary, unsigned frames, int *av_enable);
+void runahead_deinit(Runahead *r);
+
+// Runs one host frame in place of core_run.
+bool runahead_run(Runahead *r);
+
+#endif
@@ -0,0 +1,340 @@
+// for O_DIRECT
+#define _GNU_SOURCE
+#include "savestate.h"
+#include "clock.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zstd.h>
+
+// O_DIRECT wants buffers, offsets and lengths aligned to the logical block
+// size, which 4096 covers on every common device.
+#define SAVESTATE_ALIGN 4096
+
+typedef struct SavestateHeader {
+    char magic[4];
+    U32 version;
+    U64 frame;
+    U64 state_size;
+    U64 compressed_size;
+} SavestateHeader;
+
+static size_t align_up(size_t n, size_t align) {
+    return (n + align - 1) & ~(align - 1);
+}
+
+// WRITER #######################################################################
+
+static bool write_all(int fd, const U8 *data, size_t size) {
+    while (size != 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+// data must have room to pad size up to SAVESTATE_ALIGN.
+static bool write_file(const char *path, U8 *data, size_t size) {
+    char tmp[sizeof(((SaveJob *)NULL)->path) + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    // Filesystems without O_DIRECT (tmpfs) refuse it outright.
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0 && errno == EINVAL) fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+
+    size_t padded = align_up(size, SAVESTATE_ALIGN);
+    memset(data + size, 0, padded - size);
+    // O_DIRECT doesn't make the size or metadata durable; without the fsync a
+    // crash could leave the rename pointing at a short file.
+    bool ok = write_all(fd, data, padded) && ftruncate(fd, (off_t)size) == 0 && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) unlink(tmp);
+    return ok;
+}
+
+static void *writer_main(void *arg) {
+    Savestates *s = arg;
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    size_t capacity = align_up(sizeof(SavestateHeader) + ZSTD_compressBound(s->state_size), SAVESTATE_ALIGN);
+    U8 *out = aligned_alloc(SAVESTATE_ALIGN, capacity);
+
+    pthread_mutex_lock(&s->lock);
+    while (true) {
+        while (s->job_count == 0 && !s->quit)
+            pthread_cond_wait(&s->wake, &s->lock);
+        if (s->job_count == 0) break;
+        SaveJob job = s->jobs[s->job_first];
+        s->job_first = (s->job_first + 1) % SAVESTATE_POOL;
+        s->job_count--;
+        pthread_mutex_unlock(&s->lock);
+
+        double t0 = time_now();
+        size_t compressed = 0;
+        bool ok = cctx != NULL && out != NULL;
+        if (ok) {
+            compressed = ZSTD_compressCCtx(cctx, out + sizeof(SavestateHeader),
+                capacity - sizeof(SavestateHeader), job.state, s->state_size, s->level);
+            ok = !ZSTD_isError(compressed);
+        }
+        double t1 = time_now();
+
+        // The state is no longer needed, hand the buffer back before writing.
+        pthread_mutex_lock(&s->lock);
+        s->pool[s->free_count++] = job.state;
+        pthread_mutex_unlock(&s->lock);
+
+        size_t size = sizeof(SavestateHeader) + compressed;
+        if (ok) {
+            SavestateHeader header = {
+                .version = SAVESTATE_VERSION,
+                .frame = job.frame,
+                .state_size = s->state_size,
+                .compressed_size = compressed,
+            };
+            memcpy(header.magic, SAVESTATE_MAGIC, 4);
+            memcpy(out, &header, sizeof(header));
+            ok = write_file(job.path, out, size);
+        }
+        double t2 = time_now();
+
+        pthread_mutex_lock(&s->lock);
+        s->writes_pending--;
+        if (ok) {
+            s->stats.saves++;
+            s->stats.written_bytes += size;
+            s->stats.queue_time += t0 - job.queued_at;
+            s->stats.compress_time += t1 - t0;
+            s->stats.write_time += t2 - t1;
+        } else {
+            s->stats.failed++;
+            fprintf(stderr, "could not write savestate %s\n", job.path);
+        }
+        pthread_cond_broadcast(&s->wake);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    free(out);
+    ZSTD_freeCCtx(cctx);
+    return NULL;
+}
+
+// LOADER #######################################################################
+
+static bool read_state(Savestates *s, ZSTD_DCtx *dctx, const char *path, U64 *frame) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    double t0 = time_now();
+    struct stat st;
+    U8 *data = NULL;
+    size_t size = 0;
+    bool ok = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SavestateHeader);
+    if (ok) {
+        size = (size_t)st.st_size;
+        ok = (data = malloc(size)) != NULL;
+    }
+    for (size_t done = 0; ok && done < size;) {
+        ssize_t n = pread(fd, data + done, size - done, (off_t)done);
+        if (n < 0 && errno == EINTR) continue;
+        ok = n > 0;
+        if (ok) done += (size_t)n;
+    }
+    close(fd);
+    double t1 = time_now();
+
+    SavestateHeader header;
+    if (ok) {
+        memcpy(&header, data, sizeof(header));
+        ok = memcmp(header.magic, SAVESTATE_MAGIC, 4) == 0
+            && header.version == SAVESTATE_VERSION
+            && header.state_size == s->state_size
+            && header.compressed_size == size - sizeof(header);
+    }
+    if (ok) {
+        size_t decompressed = ZSTD_decompressDCtx(dctx, s->load_state, s->state_size,
+            data + sizeof(header), size - sizeof(header));
+        ok = !ZSTD_isError(decompressed) && decompressed == s->state_size;
+        *frame = header.frame;
+    }
+    free(data);
+    double t2 = time_now();
+
+    s->stats.read_time += t1 - t0;
+    s->stats.decompress_time += t2 - t1;
+    return ok;
+}
+
+static void *loader_main(void *arg) {
+    Savestates *s = arg;
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    char path[sizeof(s->load_path)];
+
+    pthread_mutex_lock(&s->lock);
+    while (true) {
+        // A file that is still being written would be read stale.
+        while ((s->load_status != LOAD_PENDING || s->writes_pending != 0) && !s->quit)
+            pthread_cond_wait(&s->wake, &s->lock);
+        if (s->quit) break;
+        U64 request = s->load_request;
+        memcpy(path, s->load_path, sizeof(path));
+        pthread_mutex_unlock(&s->lock);
+
+        U64 frame = 0;
+        bool ok = dctx != NULL && read_state(s, dctx, path, &frame);
+
+        pthread_mutex_lock(&s->lock);
+        // Prefetched again in the meantime, that request wins.
+        if (request != s->load_request) continue;
+        s->load_status = ok ? LOAD_READY : LOAD_FAILED;
+        s->load_frame = frame;
+        pthread_cond_broadcast(&s->wake);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    ZSTD_freeDCtx(dctx);
+    return NULL;
+}
+
+// API ##########################################################################
+
+bool savestate_init(Savestates *s, core_functions_t *core, int level) {
+    memset(s, 0, sizeof(*s));
+    s->core = core;
+    s->level = level;
+    s->state_size = core->core_serialize_size();
+    if (s->state_size == 0) return false;
+    if (level < ZSTD_minCLevel() || level > ZSTD_maxCLevel()) return false;
+
+    for (unsigned i = 0; i < SAVESTATE_POOL; ++i) {
+        s->pool[i] = malloc(s->state_size);
+        if (s->pool[i] == NULL) {
+            for (unsigned j = 0; j < i; ++j) free(s->pool[j]);
+            return false;
+        }
+    }
+    s->free_count = SAVESTATE_POOL;
+    s->load_state = malloc(s->state_size);
+    if (s->load_state == NULL) {
+        for (unsigned i = 0; i < SAVESTATE_POOL; ++i) free(s->pool[i]);
+        return false;
+    }
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->wake, NULL);
+    bool writer = pthread_create(&s->writer, NULL, writer_main, s) == 0;
+    bool loader = writer && pthread_create(&s->loader, NULL, loader_main, s) == 0;
+    if (!loader) {
+        s->quit = true;
+        if (writer) pthread_join(s->writer, NULL);
+        pthread_cond_destroy(&s->wake);
+        pthread_mutex_destroy(&s->lock);
+        for (unsigned i = 0; i < SAVESTATE_POOL; ++i) free(s->pool[i]);
+        free(s->load_state);
+        return false;
+    }
+    return true;
+}
+
+void savestate_deinit(Savestates *s) {
+    pthread_mutex_lock(&s->lock);
+    s->quit = true;
+    pthread_cond_broadcast(&s->wake);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->writer, NULL);
+    pthread_join(s->loader, NULL);
+
+    pthread_cond_destroy(&s->wake);
+    pthread_mutex_destroy(&s->lock);
+    for (unsigned i = 0; i < SAVESTATE_POOL; ++i) free(s->pool[i]);
+    free(s->load_state);
+    SavestateStats stats = s->stats;
+    memset(s, 0, sizeof(*s));
+    s->stats = stats;
+}
+
+bool savestate_save(Savestates *s, const char *path, U64 frame) {
+    if (strlen(path) >= sizeof(s->jobs[0].path)) return false;
+
+    pthread_mutex_lock(&s->lock);
+    U8 *state = s->free_count != 0 ? s->pool[--s->free_count] : NULL;
+    pthread_mutex_unlock(&s->lock);
+    if (state == NULL) {
+        s->stats.dropped++;
+        return false;
+    }
+
+    double t0 = time_now();
+    bool ok = s->core->core_serialize(state, s->state_size);
+    double t1 = time_now();
+
+    pthread_mutex_lock(&s->lock);
+    if (ok) {
+        SaveJob *job = &s->jobs[(s->job_first + s->job_count++) % SAVESTATE_POOL];
+        snprintf(job->path, sizeof(job->path), "%s", path);
+        job->state = state;
+        job->frame = frame;
+        job->queued_at = t1;
+        s->writes_pending++;
+        s->stats.state_bytes += s->state_size;
+        s->stats.serialize_time += t1 - t0;
+        // The prefetched copy of this file is about to be out of date.
+        if (strcmp(s->load_path, path) == 0) {
+            if (s->load_status == LOAD_PENDING) s->load_request++;
+            else s->load_status = LOAD_IDLE;
+        }
+        pthread_cond_broadcast(&s->wake);
+    } else {
+        s->pool[s->free_count++] = state;
+        s->stats.failed++;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return ok;
+}
+
+void savestate_prefetch(Savestates *s, const char *path) {
+    pthread_mutex_lock(&s->lock);
+    bool same = strcmp(s->load_path, path) == 0;
+    if (!same || s->load_status == LOAD_IDLE || s->load_status == LOAD_FAILED) {
+        snprintf(s->load_path, sizeof(s->load_path), "%s", path);
+        s->load_status = LOAD_PENDING;
+        s->load_request++;
+        pthread_cond_broadcast(&s->wake);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+LoadStatus savestate_poll_load(Savestates *s, U64 *frame) {
+    pthread_mutex_lock(&s->lock);
+    LoadStatus status = s->load_status;
+    U64 load_frame = s->load_frame;
+    pthread_mutex_unlock(&s->lock);
+    if (status != LOAD_READY) return status;
+
+    // Only the loader writes load_state, and only while a load is pending.
+    double t0 = time_now();
+    bool ok = s->core->core_unserialize(s->load_state, s->state_size);
+    s->stats.unserialize_time += time_now() - t0;
+    if (!ok) return LOAD_FAILED;
+    s->stats.loads++;
+    *frame = load_frame;
+    return LOAD_READY;
+}
+
+bool savestate_load(Savestates *s, const char *path, U64 *frame) {
+    savestate_prefetch(s, path);
+    pthread_mutex_lock(&s->lock);
+    while (s->load_status == LOAD_PENDING)
+        pthread_cond_wait(&s->wake, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    return savestate_poll_load(s, frame) == LOAD_READY;
+}
@@ -0,0 +1,109 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include "core.h"
+#include "types.h"
+
+#include <pthread.h>
+
+// Savestates on disk without stalling the emulation thread. Saving only
+// serializes the core into a free buffer from a small pool and queues it; a
+// writer thread compresses it with zstd and writes it with O_DIRECT to a
+// temporary file that is renamed over the target once complete. When every
+// buffer is still queued the save is dropped rather than waited for.
+//
+// Loading is split the same way: savestate_prefetch has a loader thread read
+// and decompress a file, and savestate_poll_load unserializes it on the
+// emulation thread once it is ready. A prefetched state stays valid until the
+// next save to the same path, so loading it again costs only the unserialize.
+//
+// File format, host byte order:
+//   "DESS", U32 version, U64 frame, U64 state size, U64 compressed size,
+//   then the zstd frame.
+
+#define SAVESTATE_MAGIC "DESS"
+#define SAVESTATE_VERSION 1
+#define SAVESTATE_POOL 3
+#define SAVESTATE_DEFAULT_LEVEL 3
+
+typedef struct SavestateStats {
+    U64 saves;
+    U64 dropped;        // no free buffer when asked to save
+    U64 failed;
+    U64 state_bytes;
+    U64 written_bytes;
+    double serialize_time; // emulation thread
+    double queue_time;     // queued until the writer picked it up
+    double compress_time;
+    double write_time;
+
+    U64 loads;
+    double read_time;
+    double decompress_time;
+    double unserialize_time; // emulation thread
+} SavestateStats;
+
+typedef struct SaveJob {
+    char path[4096];
+    U8 *state;
+    U64 frame;
+    double queued_at;
+} SaveJob;
+
+typedef enum LoadStatus {
+    LOAD_IDLE,
+    LOAD_PENDING,
+    LOAD_READY,
+    LOAD_FAILED,
+} LoadStatus;
+
+typedef struct Savestates {
+    core_functions_t *core;
+    size_t state_size;
+    int level;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;     // writer and loader wait on this
+    bool quit;
+
+    U8 *pool[SAVESTATE_POOL];
+    unsigned free_count;     // pool[0..free_count) are free
+    SaveJob jobs[SAVESTATE_POOL];
+    unsigned job_first;
+    unsigned job_count;
+    unsigned writes_pending; // queued or being written
+    pthread_t writer;
+
+    char load_path[4096];
+    LoadStatus load_status;
+    U64 load_request;        // bumped to make the loader drop what it is reading
+    U8 *load_state;
+    U64 load_frame;
+    pthread_t loader;
+
+    SavestateStats stats;
+} Savestates;
+
+// level is a zstd level. Call once a game is loaded.
+bool savestate_init(Savestates *s, core_functions_t *core, int level);
+
+// Waits for queued saves to finish writing.
+void savestate_deinit(Savestates *s);
+
+// Serializes the core and queues it for writing to path. Returns false if
+// the core could not serialize or every buffer is still waiting to be written.
+bool savestate_save(Savestates *s, const char *path, U64 frame);
+
+// Starts reading and decompressing path in the background. Does nothing if
+// path is already prefetched or pending.
+void savestate_prefetch(Savestates *s, const char *path);
+
+// Unserializes the prefetched state if it is ready. Returns LOAD_READY after
+// loading it, with its frame in *frame, LOAD_PENDING while the loader is still
+// busy and LOAD_FAILED or LOAD_IDLE if there is nothing to load.
+LoadStatus savestate_poll_load(Savestates *s, U64 *frame);
+
+// Prefetches path and blocks until it is loaded.
+bool savestate_load(Savestates *s, const char *path, U64 *frame);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// x86 intrinsics for the vector kernels. AVX2 kernels are compiled for AVX2
+// one function at a time and only called after __builtin_cpu_supports.
+#if defined(__x86_64__) || defined(__i386__)
+  #define HAVE_X86 1
+  #include <immintrin.h>
+#else
+  #define HAVE_X86 0
+#endif
+
+#define AVX2 __attribute__((target("avx2")))
+
+#endif
@@ -0,0 +1,356 @@
+#include "statetree.h"
+#include "clock.h"
+#include "delta.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Deltas larger than this fraction of the state are stored whole instead.
+#define STATETREE_DELTA_LIMIT 4
+
+static bool has_whole(const StateTreeNode *n) {
+    return n->payload != NULL && n->full;
+}
+
+// LRU ##########################################################################
+
+static void lru_unlink(StateTree *t, StateNode id) {
+    StateTreeNode *n = &t->nodes[id];
+    if (n->lru_prev != STATETREE_NONE) t->nodes[n->lru_prev].lru_next = n->lru_next;
+    else if (t->lru_head == id) t->lru_head = n->lru_next;
+    if (n->lru_next != STATETREE_NONE) t->nodes[n->lru_next].lru_prev = n->lru_prev;
+    else if (t->lru_tail == id) t->lru_tail = n->lru_prev;
+    n->lru_prev = n->lru_next = STATETREE_NONE;
+}
+
+static void lru_push(StateTree *t, StateNode id) {
+    StateTreeNode *n = &t->nodes[id];
+    n->lru_prev = STATETREE_NONE;
+    n->lru_next = t->lru_head;
+    if (t->lru_head != STATETREE_NONE) t->nodes[t->lru_head].lru_prev = id;
+    t->lru_head = id;
+    if (t->lru_tail == STATETREE_NONE) t->lru_tail = id;
+}
+
+// The root is pinned and never on the list.
+static void touch(StateTree *t, StateNode id) {
+    if (id == 0 || t->nodes[id].payload == NULL) return;
+    lru_unlink(t, id);
+    lru_push(t, id);
+}
+
+static void drop_payload(StateTree *t, StateNode id) {
+    StateTreeNode *n = &t->nodes[id];
+    if (n->payload == NULL) return;
+    lru_unlink(t, id);
+    free(n->payload);
+    n->payload = NULL;
+    t->used_bytes -= n->payload_size;
+    n->payload_size = 0;
+}
+
+static void evict(StateTree *t, StateNode keep) {
+    while (t->used_bytes > t->budget && t->lru_tail != STATETREE_NONE && t->lru_tail != keep) {
+        drop_payload(t, t->lru_tail);
+        t->stats.evictions++;
+    }
+}
+
+// PATHS ########################################################################
+
+static bool path_reserve(StateTree *t, U32 count) {
+    if (count <= t->path_capacity) return true;
+    U32 capacity = t->path_capacity ? t->path_capacity * 2 : 64;
+    while (capacity < count) capacity *= 2;
+    StateNode *path = realloc(t->path, capacity * sizeof(StateNode));
+    if (path == NULL) return false;
+    t->path = path;
+    t->path_capacity = capacity;
+    return true;
+}
+
+// Fills t->path with id and its ancestors, up to and including the nearest
+// one whose state is at hand: already in base, or stored whole. The root is
+// always stored whole, so there is one.
+static bool collect_path(StateTree *t, StateNode id, U32 *len) {
+    U32 count = 0;
+    while (true) {
+        if (!path_reserve(t, count + 1)) return false;
+        t->path[count++] = id;
+        if (id == t->cached || has_whole(&t->nodes[id])) break;
+        id = t->nodes[id].parent;
+    }
+    *len = count;
+    return true;
+}
+
+// Applies stored deltas down t->path[0..len) into base for as long as they
+// are stored, starting from the anchor at the end. Afterwards base holds
+// t->path[*remaining], which is also t->cached.
+static bool decode_path(StateTree *t, U32 len, U32 *remaining) {
+    U32 i = len - 1;
+    StateNode anchor = t->path[i];
+    if (anchor != t->cached) {
+        memcpy(t->base, t->nodes[anchor].payload, t->state_size);
+        t->cached = anchor;
+        touch(t, anchor);
+    }
+    while (i > 0 && t->nodes[t->path[i - 1]].payload != NULL) {
+        StateNode id = t->path[i - 1];
+        const StateTreeNode *n = &t->nodes[id];
+        if (n->full) memcpy(t->base, n->payload, t->state_size);
+        else if (!delta_decode(t->base, t->base, t->state_size, n->payload, n->payload_size)) {
+            t->cached = STATETREE_NONE;
+            return false;
+        }
+        t->cached = id;
+        t->stats.decoded += !n->full;
+        touch(t, id);
+        i--;
+    }
+    *remaining = i;
+    return true;
+}
+
+static void replay(StateTree *t, StateNode id, bool render) {
+    const StateTreeNode *n = &t->nodes[id];
+    int host_av = *t->av_enable;
+    for (U32 i = 0; i < n->input_count; ++i) {
+        for (unsigned f = 0; f < t->frames_per_input; ++f) {
+            bool last = render && i + 1 == n->input_count && f + 1 == t->frames_per_input;
+            *t->av_enable = last ? host_av & RETRO_AV_ENABLE_VIDEO : 0;
+            input_publish(&n->inputs[i]);
+            t->core->core_run();
+        }
+    }
+    *t->av_enable = host_av;
+    t->stats.replayed_frames += (U64)n->input_count * t->frames_per_input;
+}
+
+// NODES ########################################################################
+
+// node_count is the number of nodes in use, so while the free list is empty
+// it is also the next fresh id.
+static StateNode alloc_node(StateTree *t) {
+    StateNode id = t->free_list;
+    if (id != STATETREE_NONE) {
+        t->free_list = t->nodes[id].next_sibling;
+    } else {
+        if (t->node_count == t->node_capacity) {
+            if (t->node_capacity >= STATETREE_NONE / 2) return STATETREE_NONE;
+            U32 capacity = t->node_capacity ? t->node_capacity * 2 : 256;
+            StateTreeNode *nodes = realloc(t->nodes, capacity * sizeof(StateTreeNode));
+            if (nodes == NULL) return STATETREE_NONE;
+            memset(nodes + t->node_capacity, 0, (capacity - t->node_capacity) * sizeof(StateTreeNode));
+            t->nodes = nodes;
+            t->node_capacity = capacity;
+        }
+        id = t->node_count;
+    }
+    t->node_count++;
+    t->nodes[id] = (StateTreeNode) {
+        .parent = STATETREE_NONE,
+        .first_child = STATETREE_NONE,
+        .next_sibling = STATETREE_NONE,
+        .lru_prev = STATETREE_NONE,
+        .lru_next = STATETREE_NONE,
+        .used = true,
+    };
+    return id;
+}
+
+// Freed nodes are reused before the array grows.
+static void free_node(StateTree *t, StateNode id) {
+    drop_payload(t, id);
+    StateTreeNode *n = &t->nodes[id];
+    t->used_bytes -= n->input_count * sizeof(InputSnapshot);
+    free(n->inputs);
+    if (t->cached == id) t->cached = STATETREE_NONE;
+    *n = (StateTreeNode) { .next_sibling = t->free_list };
+    t->free_list = id;
+    t->node_count--;
+}
+
+static bool valid(const StateTree *t, StateNode id) {
+    return id < t->node_capacity && t->nodes[id].used;
+}
+
+// API ##########################################################################
+
+bool statetree_init(StateTree *t, core_functions_t *core, size_t budget,
+    unsigned frames_per_input, int *av_enable
+) {
+    memset(t, 0, sizeof(*t));
+    t->core = core;
+    t->budget = budget;
+    t->frames_per_input = frames_per_input ? frames_per_input : 1;
+    t->av_enable = av_enable;
+    t->free_list = t->lru_head = t->lru_tail = STATETREE_NONE;
+    t->state_size = core->core_serialize_size();
+    if (t->state_size == 0) return false;
+
+    t->base = malloc(t->state_size);
+    t->state = malloc(t->state_size);
+    t->encoded = malloc(delta_bound(t->state_size));
+    StateNode root = alloc_node(t);
+    bool ok = t->base != NULL && t->state != NULL && t->encoded != NULL && root == 0;
+    if (ok) {
+        StateTreeNode *n = &t->nodes[root];
+        n->payload = malloc(t->state_size);
+        n->payload_size = t->state_size;
+        n->full = true;
+        ok = n->payload != NULL && core->core_serialize(n->payload, t->state_size);
+    }
+    if (!ok) {
+        statetree_deinit(t);
+        return false;
+    }
+    memcpy(t->base, t->nodes[root].payload, t->state_size);
+    t->cached = root;
+    return true;
+}
+
+void statetree_deinit(StateTree *t) {
+    for (U32 i = 0; t->nodes != NULL && i < t->node_capacity; ++i) {
+        if (!t->nodes[i].used) continue;
+        free(t->nodes[i].payload);
+        free(t->nodes[i].inputs);
+    }
+    free(t->nodes);
+    free(t->base);
+    free(t->state);
+    free(t->encoded);
+    free(t->path);
+    StateTreeStats stats = t->stats;
+    memset(t, 0, sizeof(*t));
+    t->stats = stats;
+}
+
+StateNode statetree_branch(StateTree *t, StateNode parent, const InputSnapshot *inputs, U32 count) {
+    if (!valid(t, parent)) return STATETREE_NONE;
+    double start = time_now();
+
+    if (!t->core->core_serialize(t->state, t->state_size)) return STATETREE_NONE;
+
+    // The delta is against the parent's state, which is usually in base
+    // already from restoring it.
+    bool have_base = t->cached == parent;
+    if (!have_base) {
+        U32 len, remaining;
+        have_base = collect_path(t, parent, &len) && decode_path(t, len, &remaining) && remaining == 0;
+    }
+
+    U32 chain = t->nodes[parent].chain + 1;
+    bool full = !have_base || chain >= STATETREE_KEYFRAME_DEPTH;
+    size_t size = 0;
+    if (!full) {
+        size = delta_encode(t->encoded, t->state_size / STATETREE_DELTA_LIMIT, t->state, t->base, t->state_size);
+        // An unchanged state encodes to nothing as well, and stays a delta.
+        full = size == 0 && memcmp(t->state, t->base, t->state_size) != 0;
+    }
+    if (full) size = t->state_size;
+
+    StateNode id = alloc_node(t);
+    if (id == STATETREE_NONE) return STATETREE_NONE;
+    StateTreeNode *n = &t->nodes[id];
+    // An empty delta still needs a payload to count as stored.
+    n->payload = malloc(size ? size : 1);
+    n->inputs = malloc(count * sizeof(InputSnapshot));
+    if (n->payload == NULL || (count != 0 && n->inputs == NULL)) {
+        free_node(t, id);
+        return STATETREE_NONE;
+    }
+    memcpy(n->payload, full ? t->state : t->encoded, size);
+    memcpy(n->inputs, inputs, count * sizeof(InputSnapshot));
+    n->payload_size = size;
+    n->input_count = count;
+    n->full = full;
+    n->chain = full ? 0 : chain;
+    n->parent = parent;
+    n->next_sibling = t->nodes[parent].first_child;
+    t->nodes[parent].first_child = id;
+    t->used_bytes += size + count * sizeof(InputSnapshot);
+    lru_push(t, id);
+
+    // The new node is what the core holds now, keep it at hand.
+    U8 *base = t->base;
+    t->base = t->state;
+    t->state = base;
+    t->cached = id;
+
+    evict(t, id);
+    t->stats.branches++;
+    t->stats.full_states += full;
+    t->stats.branch_time += time_now() - start;
+    return id;
+}
+
+bool statetree_restore(StateTree *t, StateNode node) {
+    if (!valid(t, node)) return false;
+    double start = time_now();
+
+    U32 len, i;
+    if (!collect_path(t, node, &len) || !decode_path(t, len, &i)) return false;
+
+    // Nodes whose state was evicted are replayed from the state before them,
+    // and the core is saved again once a stored delta can take over.
+    bool loaded = false;
+    bool ok = true;
+    while (ok && i > 0) {
+        StateNode next = t->path[i - 1];
+        if (t->nodes[next].payload != NULL && loaded) {
+            ok = t->core->core_serialize(t->base, t->state_size);
+            t->cached = ok ? t->path[i] : STATETREE_NONE;
+            loaded = false;
+        }
+        if (ok && t->nodes[next].payload != NULL) {
+            U32 remaining;
+            ok = decode_path(t, i + 1, &remaining);
+            i = remaining;
+            continue;
+        }
+        if (ok && !loaded) {
+            ok = t->core->core_unserialize(t->base, t->state_size);
+            loaded = true;
+        }
+        if (ok) replay(t, next, next == node);
+        i--;
+    }
+
+    if (ok && !loaded) {
+        ok = t->core->core_unserialize(t->base, t->state_size);
+    } else if (ok) {
+        ok = t->core->core_serialize(t->base, t->state_size);
+        t->cached = ok ? node : STATETREE_NONE;
+    }
+    touch(t, node);
+    t->stats.restores++;
+    t->stats.restore_time += time_now() - start;
+    return ok;
+}
+
+void statetree_prune(StateTree *t, StateNode node) {
+    if (node == 0 || !valid(t, node)) return;
+
+    StateTreeNode *parent = &t->nodes[t->nodes[node].parent];
+    if (parent->first_child == node) {
+        parent->first_child = t->nodes[node].next_sibling;
+    } else {
+        StateNode c = parent->first_child;
+        while (t->nodes[c].next_sibling != node) c = t->nodes[c].next_sibling;
+        t->nodes[c].next_sibling = t->nodes[node].next_sibling;
+    }
+
+    U32 stack = 0;
+    if (!path_reserve(t, 1)) return;
+    t->path[stack++] = node;
+    while (stack != 0) {
+        StateNode id = t->path[--stack];
+        for (StateNode c = t->nodes[id].first_child; c != STATETREE_NONE; c = t->nodes[c].next_sibling) {
+            // Out of memory leaks the rest of the subtree rather than corrupting it.
+            if (!path_reserve(t, stack + 1)) break;
+            t->path[stack++] = c;
+        }
+        free_node(t, id);
+    }
+}
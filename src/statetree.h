@@ -0,0 +1,98 @@
+#ifndef STATETREE_H
+#define STATETREE_H
+
+#include "core.h"
+#include "input.h"
+#include "types.h"
+
+// A tree of savestates for search: one state forked into many input
+// sequences, each of which may fork again. Every node remembers the inputs
+// that lead to it from its parent, and usually a delta (delta.h) against its
+// parent's state, so a branch costs about as much as it diverged. A node is
+// stored whole at the root, once STATETREE_KEYFRAME_DEPTH deltas are chained,
+// or when the delta would be larger than a quarter of the state.
+//
+// Stored states are kept under a memory budget by dropping the least
+// recently used. A node whose state was dropped is still reachable: restoring
+// it decodes the nearest ancestor that can be, loads that, and replays the
+// inputs from there with audio and video disabled through the host's
+// RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE flags, rendering only the last
+// frame. Replaying assumes the core is deterministic.
+//
+// The state of the most recently restored or branched node is kept decoded,
+// so expanding children of the node just restored needs no decoding at all.
+
+#define STATETREE_NONE UINT32_MAX
+#define STATETREE_KEYFRAME_DEPTH 16
+
+typedef U32 StateNode;
+
+typedef struct StateTreeStats {
+    U64 branches;
+    U64 full_states;        // branches stored whole
+    U64 restores;
+    U64 decoded;            // deltas applied while restoring
+    U64 replayed_frames;
+    U64 evictions;
+    double branch_time;
+    double restore_time;
+} StateTreeStats;
+
+typedef struct StateTreeNode {
+    StateNode parent;
+    StateNode first_child;
+    StateNode next_sibling;  // also links the free list
+    StateNode lru_prev;      // towards more recently used
+    StateNode lru_next;
+    InputSnapshot *inputs;   // from the parent, each run frames_per_input times
+    U32 input_count;
+    U32 chain;               // deltas between this node and a whole state
+    U8 *payload;             // NULL once evicted
+    size_t payload_size;
+    bool full;
+    bool used;
+} StateTreeNode;
+
+typedef struct StateTree {
+    core_functions_t *core;
+    int *av_enable;
+    unsigned frames_per_input;
+    size_t state_size;
+    size_t budget;
+    size_t used_bytes;       // payloads and inputs
+
+    StateTreeNode *nodes;
+    U32 node_capacity;
+    U32 node_count;
+    StateNode free_list;
+    StateNode lru_head;      // most recently used
+    StateNode lru_tail;
+
+    U8 *base;                // decoded state of cached
+    StateNode cached;
+    U8 *state;               // serialize target
+    U8 *encoded;             // delta_bound(state_size) scratch
+    StateNode *path;
+    U32 path_capacity;
+
+    StateTreeStats stats;
+} StateTree;
+
+// The core's current state becomes the root, node 0. The root is never
+// evicted and doesn't count against budget.
+bool statetree_init(StateTree *t, core_functions_t *core, size_t budget,
+    unsigned frames_per_input, int *av_enable);
+void statetree_deinit(StateTree *t);
+
+// Adds the core's current state as a child of parent, reached from parent's
+// state by running inputs[0..count). Call after restoring parent and running
+// exactly those inputs. Returns STATETREE_NONE on failure.
+StateNode statetree_branch(StateTree *t, StateNode parent, const InputSnapshot *inputs, U32 count);
+
+// Puts the core in node's state.
+bool statetree_restore(StateTree *t, StateNode node);
+
+// Removes a node other than the root together with its descendants.
+void statetree_prune(StateTree *t, StateNode node);
+
+#endif
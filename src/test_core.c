@@ -0,0 +1,101 @@
+#include "test_core.h"
+#include "libretro.h"
+#include "types.h"
+
+#include <signal.h>
+#include <string.h>
+
+#define TEST_CORE_WIDTH 64
+#define TEST_CORE_HEIGHT 48
+
+static retro_environment_t environment;
+static retro_video_refresh_t video;
+static retro_input_poll_t poll_input;
+static retro_input_state_t input;
+
+static U8 ram[TEST_CORE_RAM];
+static U32 pixels[TEST_CORE_WIDTH * TEST_CORE_HEIGHT];
+
+RETRO_API void retro_set_environment(retro_environment_t cb) { environment = cb; }
+RETRO_API void retro_set_video_refresh(retro_video_refresh_t cb) { video = cb; }
+RETRO_API void retro_set_audio_sample(retro_audio_sample_t cb) { (void)cb; }
+RETRO_API void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb) { (void)cb; }
+RETRO_API void retro_set_input_poll(retro_input_poll_t cb) { poll_input = cb; }
+RETRO_API void retro_set_input_state(retro_input_state_t cb) { input = cb; }
+
+RETRO_API void retro_init(void) { memset(ram, 0, sizeof(ram)); }
+RETRO_API void retro_deinit(void) {}
+RETRO_API unsigned retro_api_version(void) { return RETRO_API_VERSION; }
+RETRO_API void retro_set_controller_port_device(unsigned port, unsigned device) { (void)port; (void)device; }
+RETRO_API void retro_reset(void) { memset(ram, 0, sizeof(ram)); }
+
+RETRO_API void retro_get_system_info(struct retro_system_info *info) {
+    memset(info, 0, sizeof(*info));
+    info->library_name = "test";
+    info->library_version = "1";
+    info->need_fullpath = true;
+}
+
+RETRO_API void retro_get_system_av_info(struct retro_system_av_info *info) {
+    memset(info, 0, sizeof(*info));
+    info->geometry = (struct retro_game_geometry) {
+        TEST_CORE_WIDTH, TEST_CORE_HEIGHT, TEST_CORE_WIDTH, TEST_CORE_HEIGHT, 4.0f / 3.0f,
+    };
+    info->timing.fps = 60.0;
+}
+
+RETRO_API void retro_run(void) {
+    poll_input();
+    U16 buttons = (U16)input(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_MASK);
+    if (buttons & TEST_CORE_DIE) raise(SIGKILL);
+
+    U32 counter;
+    memcpy(&counter, ram, sizeof(counter));
+    counter += buttons + 1u;
+    memcpy(ram, &counter, sizeof(counter));
+
+    for (size_t i = 0; i < TEST_CORE_WIDTH * TEST_CORE_HEIGHT; ++i) pixels[i] = counter;
+    video(pixels, TEST_CORE_WIDTH, TEST_CORE_HEIGHT, TEST_CORE_WIDTH * sizeof(U32));
+}
+
+RETRO_API size_t retro_serialize_size(void) { return sizeof(ram); }
+
+RETRO_API bool retro_serialize(void *data, size_t size) {
+    if (size != sizeof(ram)) return false;
+    memcpy(data, ram, size);
+    return true;
+}
+
+RETRO_API bool retro_unserialize(const void *data, size_t size) {
+    if (size != sizeof(ram)) return false;
+    memcpy(ram, data, size);
+    return true;
+}
+
+RETRO_API void retro_cheat_reset(void) {}
+RETRO_API void retro_cheat_set(unsigned index, bool enabled, const char *code) { (void)index; (void)enabled; (void)code; }
+
+RETRO_API bool retro_load_game(const struct retro_game_info *game) {
+    (void)game;
+    enum retro_pixel_format format = RETRO_PIXEL_FORMAT_XRGB8888;
+    environment(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &format);
+    struct retro_memory_descriptor ram_descriptor = {
+        .flags = RETRO_MEMDESC_SYSTEM_RAM,
+        .ptr = ram,
+        .start = TEST_CORE_ADDRESS,
+        .len = sizeof(ram),
+    };
+    struct retro_memory_map map = { .descriptors = &ram_descriptor, .num_descriptors = 1 };
+    environment(RETRO_ENVIRONMENT_SET_MEMORY_MAPS, &map);
+    return true;
+}
+
+RETRO_API bool retro_load_game_special(unsigned type, const struct retro_game_info *info, size_t num) {
+    (void)type; (void)info; (void)num;
+    return false;
+}
+
+RETRO_API void retro_unload_game(void) {}
+RETRO_API unsigned retro_get_region(void) { return RETRO_REGION_NTSC; }
+RETRO_API void *retro_get_memory_data(unsigned id) { return id == RETRO_MEMORY_SYSTEM_RAM ? ram : NULL; }
+RETRO_API size_t retro_get_memory_size(unsigned id) { return id == RETRO_MEMORY_SYSTEM_RAM ? sizeof(ram) : 0; }
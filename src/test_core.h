@@ -0,0 +1,13 @@
+#ifndef TEST_CORE_H
+#define TEST_CORE_H
+
+// Minimal libretro core for the tests, built as test_core.so. Its guest memory
+// is TEST_CORE_RAM bytes at TEST_CORE_ADDRESS, and each frame adds port 1's
+// buttons plus one to the U32 at the start of it. A frame run with
+// TEST_CORE_DIE held kills the process, to stand in for a core that crashes.
+
+#define TEST_CORE_ADDRESS 0x80000000u
+#define TEST_CORE_RAM 0x10000u
+#define TEST_CORE_DIE (1u << 15)   // RETRO_DEVICE_ID_JOYPAD_R3
+
+#endif
@@ -0,0 +1,127 @@
+// Checks that a rollout whose worker dies in the middle of a job comes back
+// failed and that the other workers carry on with the rest. The core is
+// test_core.so (test_core.h), which kills its process when a frame runs with
+// TEST_CORE_DIE held, so the worker dies while it holds a job and possibly
+// the shared lock.
+
+#include "env.h"
+#include "rollout.h"
+#include "test_core.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_CORE "./test_core.so"
+#define TEST_JOBS 12
+#define TEST_ACTIONS 8
+#define TEST_KILLER 5
+
+static InputSnapshot actions[TEST_JOBS][TEST_ACTIONS];
+static U32 expected[TEST_JOBS];
+
+static bool submit(Rollouts *r, U64 state, unsigned job) {
+    if (rollout_submit(r, job, state, actions[job], TEST_ACTIONS)) return true;
+    printf("%-24s FAIL, submit %u\n", "rollout", job);
+    return false;
+}
+
+// Collects `count` results and checks each against the local run. Returns
+// how many came back failed.
+static unsigned collect(Rollouts *r, unsigned count, bool *ok) {
+    unsigned failed = 0;
+    for (unsigned n = 0; n < count; ++n) {
+        RolloutResult result;
+        U32 data;
+        if (!rollout_collect(r, &result, (U8 *)&data, -1)) {
+            printf("%-24s FAIL, collect\n", "rollout");
+            *ok = false;
+            return failed;
+        }
+        if (!result.ok) {
+            ++failed;
+            if (result.tag != TEST_KILLER) *ok = false;
+        } else if (result.tag == TEST_KILLER || data != expected[result.tag]) {
+            *ok = false;
+        }
+    }
+    return failed;
+}
+
+int main(void) {
+    // A hang is what losing the lock or a job looks like.
+    alarm(10);
+
+    char store_dir[] = "/tmp/test_rollout_XXXXXX";
+    if (!mkdtemp(store_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    for (unsigned j = 0; j < TEST_JOBS; ++j) {
+        for (unsigned a = 0; a < TEST_ACTIONS; ++a)
+            actions[j][a].ports[0].buttons = (U16)((j * 3 + a) % 7);
+    }
+    actions[TEST_KILLER][TEST_ACTIONS / 2].ports[0].buttons = TEST_CORE_DIE;
+
+    // The core doesn't read its content, so any file will do for it.
+    EnvConfig env_config = {
+        .core_path = TEST_CORE,
+        .iso_path = TEST_CORE,
+        .count = 1,
+        .frame_skip = 2,
+        .warmup_frames = 3,
+    };
+    Envs *envs = env_create(&env_config);
+    ChunkStore store;
+    if (!envs || !chunkstore_open(&store, store_dir)) return 1;
+    U64 state;
+    InputSnapshot step = { 0 };
+    for (unsigned i = 0; i < 5; ++i) env_step(envs, &step, 1);
+    if (!env_save_state(envs, 0, &store, &state)) return 1;
+
+    for (unsigned j = 0; j < TEST_JOBS; ++j) {
+        if (j == TEST_KILLER) continue;
+        env_load_state(envs, 0, &store, state);
+        for (unsigned a = 0; a < TEST_ACTIONS; ++a) env_step(envs, &actions[j][a], 1);
+        memmap_read(env_memory(envs, 0), TEST_CORE_ADDRESS, (U8 *)&expected[j], sizeof(expected[j]));
+    }
+    env_destroy(envs);
+    chunkstore_close(&store);
+
+    RolloutConfig config = {
+        .core_path = TEST_CORE,
+        .iso_path = TEST_CORE,
+        .store_dir = store_dir,
+        .workers = 2,
+        .slots = 4,
+        .max_actions = TEST_ACTIONS,
+        .frame_skip = 2,
+        .result_address = TEST_CORE_ADDRESS,
+        .result_size = sizeof(U32),
+    };
+    Rollouts *r = rollout_create(&config);
+    if (!r) return 1;
+
+    // The killer goes in with a full set of slots, so its slot has to be
+    // freed for the last jobs to be submitted at all.
+    bool ok = true;
+    unsigned failed = 0;
+    unsigned job = 0;
+    for (; job < 4; ++job) ok = submit(r, state, job) && ok;
+    for (; ok && job < TEST_JOBS; ++job) {
+        failed += collect(r, 1, &ok);
+        ok = submit(r, state, job) && ok;
+    }
+    if (ok) failed += collect(r, 4, &ok);
+    ok = ok && failed == 1;
+
+    printf("%-24s %s, %u jobs, %u failed\n", "worker killed mid-job", ok ? "ok" : "FAIL", TEST_JOBS, failed);
+    rollout_destroy(r);
+
+    char command[64];
+    snprintf(command, sizeof(command), "rm -rf %s", store_dir);
+    if (system(command) != 0) fprintf(stderr, "could not remove %s\n", store_dir);
+    return ok ? 0 : 1;
+}
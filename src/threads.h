@@ -0,0 +1,18 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+#include <dirent.h>
+
+// Threads in this process, from /proc/self/task. Returns 0 if it can't be read.
+static inline unsigned thread_count(void) {
+    DIR *dir = opendir("/proc/self/task");
+    if (dir == NULL) return 0;
+    unsigned count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+        if (entry->d_name[0] != '.') count++;
+    closedir(dir);
+    return count;
+}
+
+#endif
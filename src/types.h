@@ -0,0 +1,16 @@
+#ifndef TYPES_H
+#define TYPES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef uint64_t U64;
+typedef uint32_t U32;
+typedef uint16_t U16;
+typedef uint8_t U8;
+typedef int64_t I64;
+typedef int32_t I32;
+typedef int16_t I16;
+
+#endif